@@ -18,9 +18,41 @@ const static unsigned l2_cached_threshold = UNCACHED_MEM_BASE >> 20;
 volatile __attribute__ ((aligned (0x4000))) unsigned int PageTable[4096];
 volatile __attribute__ ((aligned (0x4000))) unsigned int PageTable2[NUM_4K_PAGES];
 
-const static int aa = 1;
-const static int bb = 1;
-const static int shareable = 1;
+// Cache policy of each region of the memory map
+//
+// This only restates the fixed policies the page table has always used. The capture destination, the diff
+// buffers and the OSD take the policy of whichever region they sit in; none of them has its own entry as no
+// alternative has been measured to be faster. A buffer specific policy should be added as a region here with
+// a benchmarkRAM() timing to back it.
+typedef struct {
+   const char *name;
+   int inner;
+   int outer;
+   int shareable;
+} region_policy_t;
+
+enum {
+   REGION_L1_CACHED,       // 0-64MB: code, data, capture tables and the cached buffers
+   REGION_L2_CACHED,       // 64-128MB
+   REGION_UNCACHED,        // 128MB to the peripherals: GPU memory including the framebuffer
+   REGION_CACHED_SCREEN,   // cached alias of the screen used by the capture when USE_CACHED_SCREEN is defined
+   NUM_REGIONS
+};
+
+const static region_policy_t region_policy[NUM_REGIONS] = {
+   { "L1 cached",     CACHE_POLICY_WBWA, CACHE_POLICY_WBWA, 1 },
+   { "L2 cached",     CACHE_POLICY_NC,   CACHE_POLICY_WBWA, 1 },
+   { "Uncached",      CACHE_POLICY_NC,   CACHE_POLICY_NC,   0 },
+   { "Cached screen", CACHE_POLICY_WBWA, CACHE_POLICY_WBWA, 1 }
+};
+
+static const char *policy_names[] = { "NC", "WBWA", "WT", "WBNWA" };
+
+// 1MB section descriptor using TEX = 1BB CB = AA so the inner and outer policies can be set independently
+static unsigned int section_descriptor(int region, unsigned int base) {
+   const region_policy_t *policy = &region_policy[region];
+   return base << 20 | 0x04C02 | (policy->shareable << 16) | (policy->outer << 12) | (policy->inner << 2);
+}
 
 #define SETWAY_LEVEL_SHIFT          1
 
@@ -154,10 +186,11 @@ void map_4k_page(int logical, int physical) {
    //   XP (bit 23) in SCTRL no longer exists, and we see to be using ARMv6 table formats
    //   this means bit 0 of the page table is actually XN and must be clear to allow native ARM code to execute
    //   (this was the cause of issue #27)
+   const region_policy_t *policy = &region_policy[REGION_L1_CACHED];
    if (_get_hardware_id() >= _RPI2) {
-       PageTable2[logical] = (physical<<12) | 0x132 | (bb << 6) | (aa << 2);
+       PageTable2[logical] = (physical<<12) | 0x132 | (policy->outer << 6) | (policy->inner << 2);
    } else {
-       PageTable2[logical] = (physical<<12) | 0x133 | (bb << 6) | (aa << 2);
+       PageTable2[logical] = (physical<<12) | 0x133 | (policy->outer << 6) | (policy->inner << 2);
    }
 }
 
@@ -209,6 +242,11 @@ void enable_MMU_and_IDCaches(int cached_screen_area, int cached_screen_size)
    // 11 = WBNWA (write-back, no write allocate)
    /// TEX = 100; C=0; B=1 (outer non cacheable, inner write-back, write allocate)
 
+   for (i = 0; i < NUM_REGIONS; i++) {
+      log_debug("Cache policy: %-13s inner %-5s outer %-5s%s", region_policy[i].name, policy_names[region_policy[i].inner],
+                policy_names[region_policy[i].outer], region_policy[i].shareable ? " shareable" : "");
+   }
+
    for (base = 0; base < l1_cached_threshold; base++) // 0x04000000 64MB
    {
       // Value from my original RPI code = 11C0E (outer and inner write back, write allocate, shareable)
@@ -216,15 +254,15 @@ void enable_MMU_and_IDCaches(int cached_screen_area, int cached_screen_size)
       // Values from RPI2 = 11C0E (outer and inner write back, write allocate, shareable (fast but unsafe)); works on RPI
       // Values from RPI2 = 10C0A (outer and inner write through, no write allocate, shareable)
       // Values from RPI2 = 15C0A (outer write back, write allocate, inner write through, no write allocate, shareable)
-      PageTable[base] = base << 20 | 0x04C02 | (shareable << 16) | (bb << 12) | (aa << 2);
+      PageTable[base] = section_descriptor(REGION_L1_CACHED, base);
    }
    for (; base < l2_cached_threshold; base++) // 0x08000000 128MB
    {
-      PageTable[base] = base << 20 | 0x04C02 | (shareable << 16) | (bb << 12);
+      PageTable[base] = section_descriptor(REGION_L2_CACHED, base);
    }
    for (; base < (_get_peripheral_base() >> 20); base++)
    {
-      PageTable[base] = base << 20 | 0x01C02;
+      PageTable[base] = section_descriptor(REGION_UNCACHED, base);
    }
    for (; base < 4096; base++)
    {
@@ -236,7 +274,7 @@ void enable_MMU_and_IDCaches(int cached_screen_area, int cached_screen_size)
    if (cached_screen_area != 0) {
        for (base = (cached_screen_area >> 20); base < ((cached_screen_area + cached_screen_size) >> 20); base++)
        {
-          PageTable[base] = base << 20 | 0x04C02 | (shareable << 16) | (bb << 12) | (aa << 2);  //cached part of screen ram
+          PageTable[base] = section_descriptor(REGION_CACHED_SCREEN, base);  //cached part of screen ram
        }
    }
 #endif
@@ -299,7 +337,8 @@ void enable_MMU_and_IDCaches(int cached_screen_area, int cached_screen_size)
        // [Bit 4, Bit 3] indicates outer cachability: 01 = normal memory, outer write-back write-allocate cacheable
        // Bit 1 indicates sharable
        // 4A = 0100 1010
-       int attr = ((aa & 1) << 6) | (bb << 3) | (shareable << 1) | ((aa & 2) >> 1);
+       const region_policy_t *policy = &region_policy[REGION_L1_CACHED];
+       int attr = ((policy->inner & 1) << 6) | (policy->outer << 3) | (policy->shareable << 1) | ((policy->inner & 2) >> 1);
        asm volatile ("mcr p15, 0, %0, c2, c0, 0" :: "r" (attr | (unsigned) &PageTable));
    } else {
        // set TTBR0 (page table walk inner cacheable, outer non-cacheable, shareable memory)
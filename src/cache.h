@@ -14,6 +14,12 @@
 // Location of the high vectors (last page of L1 cached memory)
 #define HIGH_VECTORS_BASE (L2_CACHED_MEM_BASE - 0x1000)
 
+// Cache policies for the inner (L1) and outer (L2) levels of a region
+#define CACHE_POLICY_NC    0   // non-cacheable
+#define CACHE_POLICY_WBWA  1   // write-back, write allocate
+#define CACHE_POLICY_WT    2   // write-through
+#define CACHE_POLICY_WBNWA 3   // write-back, no write allocate
+
 // The first 2MB of memory is mapped at 4K pages so the 6502 Co Pro
 // can play tricks with banks selection
 #define NUM_4K_PAGES 512
@@ -52,6 +52,39 @@
 // (it can be set to less that this on the OSD)
 #define NBUFFERS 4
 
+// Num Buffers setting for single buffered beam racing, with the HDMI scanout held
+// BEAM_RACE_GAP lines behind the capture and double buffering used while the gap is lost
+#define BEAM_RACE_BUFFERS 4
+#define BEAM_RACE_GAP 8
+#define BEAM_RACE_MIN_GAP 2
+
+// The furthest the frame pacer may fall behind the latest capture, limited so the
+// capture never writes into a buffer that may still be on screen
+#define FRAME_PACING_MAX_DEPTH 1
+
+#define MULTICORE_QUEUE_SIZE 16     // jobs that can be queued for each worker core (power of 2)
+
+#define FIELD_TASK_MARGIN_LINES 4   // lines left spare before the next field sync when running deferred tasks
+#define FIELD_TASK_MIN_LINES 2      // lines of time an overdue task is given, out of the spare lines if the blanking has none left
+
+#define LINE_FIFO_DEPTH 4          // number of raw 12 bit lines that can be queued for the colour correction LUT on core 1 (power of 2)
+#define LINE_FIFO_SLOT_SHIFT 12     // log2 of the size in bytes of each raw line (2048 pixels)
+
+#define CGA_LINE_RING 4            // number of captured lines that can be queued for the CGA artifact decode on core 1 (power of 2)
+
+// Motion adaptive deinterlace block size in words, the maximum number of blocks per line and lines per field
+#define MA_BLOCK_WORDS 8
+#define MA_MAX_BLOCKS 128
+#define MA_MAX_LINES 320
+#define MA_CAPTURE_MARGIN 2        // lines the capture of the next field must be short of a line before it is deinterlaced
+
+// Mode 7 pixel bits and the motion flags kept alongside them in the comparison buffer
+#define M7_PIXEL_MASK   0x77777777
+#define M7_MOTION_FLAG1 0x80000000
+#define M7_MOTION_FLAG2 0x00800000
+#define M7_MOTION_FLAG3 0x00008000
+#define M7_MOTION_FLAG4 0x00000080
+
 #define VSYNCINT 16
 
 // Control bits (maintained in r3)
@@ -351,6 +384,7 @@ typedef struct {
 #define FORCE_BLANK_FILE_MESSAGE "Deleting this file will force the CPLD to be erased on the next reset\r\n"
 #define FORCE_UPDATE_FILE_MESSAGE "Deleting this file will force a CPLD update check on the next reset\r\n"
 #define BLANK_FILE "/cpld_firmware/recovery/blank/BLANK.xsvf"
+#define CPLD_PROGRAMMED_FILE "/cpld_firmware/programmed.txt"
 
 #define PAXHEADER "PaxHeader"
 
@@ -422,12 +456,19 @@ typedef struct {
 #define GENLOCK_NLINES_THRESHOLD 350
 #define GENLOCK_FORCE 1
 
-#define GENLOCK_PPM_STEP 334
-#define GENLOCK_MAX_STEPS 6
-#define GENLOCK_THRESHOLDS {0, 5, 10, 16, 25, 35}
-#define GENLOCK_LOCKED_THRESHOLD 2
-#define GENLOCK_FRAME_DELAY 12
+// PI genlock loop gains indexed by genlock speed (slow, medium, fast)
+// KP is ppm per line of phase error, KI is in 1/256 ppm per line per frame
+#define GENLOCK_PI_FRAC_BITS 8
+#define GENLOCK_PI_KP {25, 60, 120}
+#define GENLOCK_PI_KI {12, 72, 284}
+#define GENLOCK_PI_MAX_PPM {333, 1000, 2000}
+#define GENLOCK_LOCK_WINDOW 1
+#define GENLOCK_UNLOCK_WINDOW 5
+#define GENLOCK_LOCK_FRAMES 50
+#define VSYNC_PHASE_FILTER 3
+#define PI_VSYNC_REPEAT_CYCLES 0x10000  // a Pi vsync FIQ within this many cycles of the last is the same vsync raised again
 #define GENLOCK_SLEW_RATE_THRESHOLD 10000
+#define GENLOCK_SLEW_FRAMES 12        // the genlock speed slew limit (ppm) is spread over this many frames (doubled for slow and medium)
 
 #define MEASURE_NLINES 100
 #define PLL_PPM_LO 1
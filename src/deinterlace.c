@@ -0,0 +1,183 @@
+#include <stdint.h>
+#include <string.h>
+#include "defs.h"
+#include "osd.h"
+#include "rgb_to_fb.h"
+#include "rgb_to_hdmi.h"
+#include "deinterlace.h"
+#include "multicore.h"
+
+// Motion adaptive deinterlace run on the worker cores after each field has been captured
+//
+// For interlaced sources other than teletext the capture weaves each field into buffer 0 as it does
+// for the Weave setting. Each block of the new field's lines is then compared with the previous field
+// of the same parity, which is kept as a checksum per block in cached memory so only the new line is
+// read from the frame buffer. Where a block has changed in the line above or below, the opposite
+// field's block is replaced with a copy of the line above (bob) so moving areas don't comb while
+// static areas keep the full vertical resolution.
+//
+// The opposite field's lines are overwritten by the capture of the next field, so the copies into a
+// line stop once that capture has caught up with it (capture_line_count is advanced by rgb_to_fb after
+// each line) rather than writing stale lines over the new field.
+//
+// For Mode 7 Bob and the simple motion adaptive modes (MA1-MA4) are run here instead of in the capture
+// kernel so they don't add to the per pixel capture time. Bob copies every pixel to the other field. The capture uses the no deinterlace path
+// and the same motion flags are kept in the comparison buffer (buffer 1) as the in capture version.
+// Each Mode 7 line only touches its own comparison line and the line of the other field next to it
+// so the field is split between the worker cores. The other field's line is only written while the
+// capture of the next field is still short of it as above.
+
+int deinterlace_ma_enabled = 0;
+
+static job_fn deinterlace_job;
+static int deinterlace_parts;
+static uint32_t *field_start;
+static int field_type;
+static int field_lines;
+static int field_words;
+static int mode7_motion_mask;
+static int mode7_bob;
+static int line_words;
+static int history_words;
+static uint32_t field_capture_count;
+static uint8_t motion_flags[2][MA_MAX_BLOCKS];
+static uint32_t motion_history[2][MA_MAX_LINES][MA_MAX_BLOCKS];
+
+// Returns 1 while the capture of the next field is still far enough above line l of this field
+static int ahead_of_capture(int l) {
+   return (uint32_t) capture_line_count - field_capture_count + MA_CAPTURE_MARGIN <= (uint32_t) l;
+}
+
+// Flag the blocks of a line whose checksum differs from the history and update the history
+static void detect_motion(uint32_t *line, uint32_t *history, uint8_t *flags, int blocks) {
+   for (int b = 0; b < blocks; b++) {
+      uint32_t sum = 0;
+      for (int i = 0; i < MA_BLOCK_WORDS; i++) {
+         sum = ((sum << 5) | (sum >> 27)) ^ line[i];
+      }
+      flags[b] = sum != history[b];
+      history[b] = sum;
+      line += MA_BLOCK_WORDS;
+   }
+}
+
+// Runs on a worker core
+static void deinterlace_process(int part) {
+   uint32_t (*history)[MA_MAX_BLOCKS] = motion_history[(field_type & BIT_FIELD_TYPE) ? 1 : 0];
+   uint32_t *line = field_start;
+   int blocks = line_words / MA_BLOCK_WORDS;
+   if (blocks > MA_MAX_BLOCKS) {
+      blocks = MA_MAX_BLOCKS;
+   }
+   int lines = field_lines;
+   if (lines > MA_MAX_LINES) {
+      lines = MA_MAX_LINES;
+   }
+   uint8_t *flags = motion_flags[0];
+   uint8_t *next_flags = motion_flags[1];
+   detect_motion(line, history[0], flags, blocks);
+   for (int l = 0; l < lines; l++) {
+      uint32_t *next = line + (line_words << 1);
+      if (l < lines - 1) {
+         detect_motion(next, history[l + 1], next_flags, blocks);
+      } else {
+         memcpy(next_flags, flags, blocks);
+      }
+      if (ahead_of_capture(l)) {
+         uint32_t *gap = line + line_words;
+         for (int b = 0; b < blocks; b++) {
+            if (flags[b] | next_flags[b]) {
+               memcpy(gap + b * MA_BLOCK_WORDS, line + b * MA_BLOCK_WORDS, MA_BLOCK_WORDS << 2);
+            }
+         }
+      }
+      uint8_t *tmp = flags;
+      flags = next_flags;
+      next_flags = tmp;
+      line = next;
+   }
+}
+
+// Runs on a worker core, processes every deinterlace_parts line of the field starting at part
+static void deinterlace_mode7_process(int part) {
+   uint32_t *line = field_start + part * (line_words << 1);
+   // the other field is the line above in odd fields and the line below in even fields
+   int other = (field_type & BIT_FIELD_TYPE) ? line_words : -line_words;
+   for (int l = part; l < field_lines; l += deinterlace_parts) {
+      uint32_t *compare = line + history_words;
+      // the comparison flags are always updated but the other field is left alone once the capture has reached it
+      int write_mask = ahead_of_capture(l) ? mode7_motion_mask : 0;
+      int write_all = mode7_bob && write_mask;
+      for (int i = 0; i < field_words; i++) {
+         uint32_t pixels = line[i] & M7_PIXEL_MASK;
+         uint32_t old = compare[i];
+         uint32_t flags = 0;
+         if ((pixels ^ old) & M7_PIXEL_MASK) {
+            flags |= M7_MOTION_FLAG1;        // this field has changed
+         }
+         if (compare[i + other] & M7_MOTION_FLAG1) {
+            flags |= M7_MOTION_FLAG2;        // the other field changed last time
+         }
+         if (old & M7_MOTION_FLAG1) {
+            flags |= M7_MOTION_FLAG3;        // this field changed last time
+         }
+         if (old & M7_MOTION_FLAG2) {
+            flags |= M7_MOTION_FLAG4;        // the other field changed the time before
+         }
+         compare[i] = pixels | flags;
+         if (write_all || (flags & write_mask)) {
+            line[i + other] = (line[i + other] & ~M7_PIXEL_MASK) | pixels;
+         }
+      }
+      line += deinterlace_parts * (line_words << 1);
+   }
+}
+
+// Called from the main loop before capture starts, returns 1 if motion adaptive deinterlacing will be used
+int deinterlace_setup(capture_info_t *capinfo, int enable) {
+   deinterlace_ma_enabled = enable && get_core_1_available() && !capinfo->mode7
+                            && capinfo->video_type == VIDEO_INTERLACED && (capinfo->sizex2 & SIZEX2_DOUBLE_HEIGHT);
+   deinterlace_job = deinterlace_process;
+   deinterlace_parts = 1;
+   field_lines = capinfo->nlines;
+   line_words = capinfo->pitch >> 2;
+   multicore_barrier();
+   return deinterlace_ma_enabled;
+}
+
+// As above for Mode 7, returns 1 if the deinterlace will run on core 1 rather than in the capture
+int deinterlace_setup_mode7(capture_info_t *capinfo, int mode) {
+   static const int motion_masks[] = {
+      M7_MOTION_FLAG1,
+      M7_MOTION_FLAG1 | M7_MOTION_FLAG2,
+      M7_MOTION_FLAG1 | M7_MOTION_FLAG2 | M7_MOTION_FLAG3,
+      M7_MOTION_FLAG1 | M7_MOTION_FLAG2 | M7_MOTION_FLAG3 | M7_MOTION_FLAG4
+   };
+   deinterlace_ma_enabled = get_core_1_available() && capinfo->video_type == VIDEO_TELETEXT
+                            && mode >= M7DEINTERLACE_BOB && mode <= M7DEINTERLACE_MA4;
+   mode7_bob = mode == M7DEINTERLACE_BOB;
+   if (deinterlace_ma_enabled) {
+      mode7_motion_mask = mode7_bob ? M7_MOTION_FLAG1 : motion_masks[mode - M7DEINTERLACE_MA1];
+   }
+   deinterlace_job = deinterlace_mode7_process;
+   deinterlace_parts = multicore_workers() > 0 ? multicore_workers() : 1;
+   field_lines = capinfo->nlines;
+   field_words = capinfo->chars_per_line;
+   line_words = capinfo->pitch >> 2;
+   history_words = capinfo->height * line_words;
+   multicore_barrier();
+   return deinterlace_ma_enabled;
+}
+
+// Called from the capture loop after each field, the field is skipped if the workers are still busy with the last one
+void deinterlace_field_complete(uint32_t *start, int flags) {
+   if (!multicore_idle()) {
+      return;
+   }
+   field_start = start;
+   field_type = flags;
+   field_capture_count = capture_line_count;
+   for (int part = 0; part < deinterlace_parts; part++) {
+      multicore_submit(deinterlace_job, part);
+   }
+}
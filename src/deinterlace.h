@@ -0,0 +1,15 @@
+// deinterlace.h
+
+#ifndef DEINTERLACE_H
+#define DEINTERLACE_H
+
+#include <stdint.h>
+#include "defs.h"
+
+extern int deinterlace_ma_enabled;
+
+int deinterlace_setup(capture_info_t *capinfo, int enable);
+int deinterlace_setup_mode7(capture_info_t *capinfo, int mode);
+void deinterlace_field_complete(uint32_t *field_start, int flags);
+
+#endif
@@ -24,7 +24,11 @@ size_t sd_read(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t
 size_t sd_write(struct block_device *dev, uint8_t *buf, size_t buf_size, uint32_t block_no);
 #endif
 
-//static unsigned int sd_status=STA_NOINIT;
+// Set to STA_NOINIT after a failed transfer so FatFs re-mounts the volume (e.g. card changed)
+static DSTATUS sd_status = 0;
+
+// Total sectors read, used to measure file system activity
+static DWORD sectors_read = 0;
 
 static struct emmc_block_dev bd;
 /*-----------------------------------------------------------------------*/
@@ -44,7 +48,7 @@ DSTATUS disk_status (
 
 #ifdef DRV_SD
    case DRV_SD :
-      return 0; //(sdInitCard())? STA_NOINIT:0;//mmc_disk_status();
+      return sd_status; //(sdInitCard())? STA_NOINIT:0;//mmc_disk_status();
 #endif
 
    }
@@ -68,6 +72,7 @@ DSTATUS disk_initialize (
 #ifdef DRV_SD
    case DRV_SD :
       //sd_status = (sdInitCard())? STA_NOINIT:RES_OK;
+      sd_status = 0;
       return RES_OK;//sd_status;//mmc_disk_initialize();
 #endif
    }
@@ -93,7 +98,12 @@ DRESULT disk_read (
 #endif
 #ifdef DRV_SD
    case DRV_SD :
-      return sd_read((struct block_device *)&bd,buff,512*count,sector)?RES_OK:RES_ERROR;
+      sectors_read += count;
+      if (sd_read((struct block_device *)&bd,buff,512*count,sector)) {
+         return RES_OK;
+      }
+      sd_status = STA_NOINIT;
+      return RES_ERROR;
 #endif
    }
    return RES_PARERR;
@@ -120,7 +130,11 @@ DRESULT disk_write (
 #endif
 #ifdef DRV_SD
    case DRV_SD :
-      return sd_write((struct block_device *)&bd,buff,512*count,sector)?RES_OK:RES_ERROR;
+      if (sd_write((struct block_device *)&bd,buff,512*count,sector)) {
+         return RES_OK;
+      }
+      sd_status = STA_NOINIT;
+      return RES_ERROR;
 #endif
    }
    return RES_PARERR;
@@ -155,6 +169,12 @@ DRESULT disk_ioctl (
 #endif
 
 
+DWORD disk_sectors_read (void)
+{
+   return sectors_read;
+}
+
+
 /*-----------------------------------------------------------------------*/
 /* Timer driven procedure                                                */
 /*-----------------------------------------------------------------------*/
@@ -0,0 +1,90 @@
+#include <stddef.h>
+#include <stdint.h>
+#include "defs.h"
+#include "startup.h"
+#include "rgb_to_fb.h"
+#include "field_tasks.h"
+
+// Cooperative scheduler for work deferred to the vertical blanking
+//
+// Called by the capture loop once the active lines of a field have been captured. The time left before
+// the next field sync is worked out from the measured field period and each pending task is given a
+// share of it in priority order. A task that doesn't fit is postponed to a later field until it has
+// waited for its deadline, after which it runs regardless. Long jobs return non zero to be called again
+// on the next field so they are split across fields rather than stalling the capture. An overdue task is
+// given at least FIELD_TASK_MIN_LINES, taken from the spare lines before the field sync if need be, and
+// stays overdue until it completes so it keeps making progress every field.
+
+static field_task_t *tasks;
+
+void field_task_schedule(field_task_t *task) {
+   if (!task->pending) {
+      task->pending = 1;
+      task->waited = 0;
+      task->ran = 0;
+      task->next = tasks;
+      tasks = task;
+   }
+}
+
+static void field_task_remove(field_task_t *task) {
+   field_task_t **link = &tasks;
+   while (*link != task) {
+      link = &(*link)->next;
+   }
+   *link = task->next;
+   task->pending = 0;
+}
+
+void field_tasks_run(uint32_t vsync_time) {
+   // the next field sync starts a pulse width before the end of the measured field period
+   uint32_t end = vsync_time + vsync_period - vsync_width - FIELD_TASK_MARGIN_LINES * hsync_period;
+   while (tasks) {
+      int32_t budget = (int32_t) (end - _get_cycle_counter());
+      field_task_t *best = NULL;
+      for (field_task_t *task = tasks; task; task = task->next) {
+         if (task->ran) {
+            continue;                      // already run in this field
+         }
+         int overdue = task->waited >= task->deadline;
+         if (!overdue && (budget <= 0 || (int32_t) task->cost > budget)) {
+            continue;
+         }
+         int best_overdue = best && best->waited >= best->deadline;
+         if (!best || overdue > best_overdue || (overdue == best_overdue && task->priority > best->priority)) {
+            best = task;
+         }
+      }
+      if (!best) {
+         break;
+      }
+      int overdue = best->waited >= best->deadline;
+      int32_t min_budget = FIELD_TASK_MIN_LINES * hsync_period;
+      if (overdue && budget < min_budget) {
+         // an overdue task may use the spare lines but never runs past the field sync itself
+         int32_t sync_budget = budget + FIELD_TASK_MARGIN_LINES * hsync_period;
+         budget = min_budget < sync_budget ? min_budget : sync_budget;
+         if (budget <= 0) {
+            break;
+         }
+      }
+      uint32_t start = _get_cycle_counter();
+      if (best->run(budget > 0 ? budget : 0)) {
+         best->ran = 1;
+         if (!overdue) {
+            best->waited = 0;
+         }
+      } else {
+         // only a complete run says how long the task needs, a split run just uses the budget it was given
+         best->cost = _get_cycle_counter() - start;
+         field_task_remove(best);
+      }
+   }
+   for (field_task_t *task = tasks; task; task = task->next) {
+      if (task->ran) {
+         task->ran = 0;
+      } else {
+         task->waited++;
+      }
+   }
+}
@@ -0,0 +1,25 @@
+// field_tasks.h
+
+#ifndef FIELD_TASKS_H
+#define FIELD_TASKS_H
+
+#include <stdint.h>
+
+// A task runs for at most the budget it is given (in cycles) and returns non zero if it has more work to do
+typedef int (*field_task_fn)(uint32_t budget);
+
+typedef struct field_task {
+   field_task_fn run;
+   int priority;                 // higher runs first
+   int deadline;                 // fields the task may be postponed before it runs regardless of the budget
+   int waited;                   // fields since the task last ran in full or within its budget
+   int ran;                      // set once the task has run in the current field
+   uint32_t cost;                // cycles taken by the last run
+   int pending;
+   struct field_task *next;
+} field_task_t;
+
+void field_task_schedule(field_task_t *task);
+void field_tasks_run(uint32_t vsync_time);
+
+#endif
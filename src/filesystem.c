@@ -4,6 +4,7 @@
 #include <stdint.h>
 #include "logging.h"
 #include "fatfs/ff.h"
+#include "fatfs/diskio.h"
 #include "filesystem.h"
 #include "osd.h"
 #include "rgb_to_fb.h"
@@ -23,6 +24,12 @@
 static FATFS fsObject;
 static int capture_id = -1;
 
+// The volume is mounted on first use and stays mounted, init_filesystem/close_filesystem
+// just bracket a reference counted session
+static int fs_mounted = 0;
+static int fs_sessions = 0;
+static unsigned int fs_session_start_reads = 0;
+
 #ifdef USE_LODEPNG
 
 static int generate_png(capture_info_t *capinfo, uint8_t **png, unsigned int *png_len ) {
@@ -365,21 +372,31 @@ static void initialize_capture_id(char * path) {
 void init_filesystem() {
    FRESULT result;
 
-   // Mount file system
-   result = f_mount(&fsObject, "", 1);
-   if (result != FR_OK) {
-      log_warn("Failed to initialize file system");
-      return;
+   if (!fs_mounted) {
+      // Mount file system, FatFs will re-read the volume itself if diskio reports the card needs initialising
+      result = f_mount(&fsObject, "", 1);
+      if (result != FR_OK) {
+         log_warn("Failed to initialize file system");
+         return;
+      }
+      fs_mounted = 1;
+   }
+   if (fs_sessions++ == 0) {
+      fs_session_start_reads = disk_sectors_read();
    }
 }
 
-void close_filesystem() {
-   FRESULT result;
+void sync_filesystem() {
+   // Writes are flushed by f_close/f_sync, this is the explicit sync point for the card itself
+   if (fs_mounted && disk_ioctl(0, CTRL_SYNC, NULL) != RES_OK) {
+      log_warn("Failed to sync file system");
+   }
+}
 
-   // UnMount file system
-   result = f_mount(NULL, "", 1);
-   if (result != FR_OK) {
-      log_warn("Failed to close file system");
+void close_filesystem() {
+   if (fs_sessions > 0 && --fs_sessions == 0) {
+      sync_filesystem();
+      log_debug("File system session complete: %d sectors read", disk_sectors_read() - fs_session_start_reads);
    }
 }
 
@@ -420,6 +437,7 @@ void capture_screenshot(capture_info_t *capinfo, char *profile) {
    result = f_open(&file, filepath, FA_CREATE_NEW | FA_WRITE);
    if (result != FR_OK) {
       log_warn("Failed to create capture file %s (result = %d)", filepath, result);
+      close_filesystem();
       return;
    }
    capture_id++;
@@ -1115,6 +1133,7 @@ FRESULT result;
            return result;
        }
        log_info("%s deleting complete", path);
+       close_filesystem();
        return result;
 }
 
@@ -1,4 +1,5 @@
 #include <stdio.h>
+#include <string.h>
 #include "geometry.h"
 #include "cpld.h"
 #include "osd.h"
@@ -115,6 +116,7 @@ static geometry_t *geometry;
 static geometry_t set1_geometry;
 static geometry_t set2_geometry;
 static int scaling = 0;
+static int prescale = 0;
 static int capvscale = 1;
 static int caphscale = 1;
 static int fhaspect = 1;
@@ -351,12 +353,119 @@ int get_gscaling() {
    return scaling;
 }
 
+void set_gprescale(int value) {
+   prescale = value;
+}
+
+int get_gprescale() {
+   return prescale;
+}
+
+int get_gprescale_available() {
+#ifdef USE_ARM_CAPTURE
+   // the ARM capture can't double the height on Pi Zero 2 / Pi 2 / Pi 3 (see below) so the prescale would only be 2x1
+   if (_get_hardware_id() == _RPI2 || _get_hardware_id() == _RPI3) {
+      return 0;
+   }
+#endif
+   return 1;
+}
+
 void set_setup_mode(int mode) {
     geometry_set_value(SETUP_MODE, mode);
     //log_info("setup mode = %d", mode);
 }
 
+#define NUM_FB_PARAMS_PARAMETERS 15
+
+// Everything geometry_calculate_fb_params depends on, so the result can be reused while none of it changes
+typedef struct {
+    capture_info_t capinfo;
+    geometry_t geometry;
+    int modeset;
+    int scaling;
+    int prescale;
+    int use_px_sampling;
+    int parameters[NUM_FB_PARAMS_PARAMETERS];
+    int hdisplay;
+    int vdisplay;
+    int true_vdisplay;
+    int startup_overscan;
+    int overscan[4];
+    int delay;
+    int sync_edge;
+    int ntscphase;
+    int lines_per_vsync;
+    int vsync_width_lines;
+    int core_1_available;
+    int osd_active;
+    int menu_active;
+} fb_params_key_t;
+
+static const int fb_params_parameters[NUM_FB_PARAMS_PARAMETERS] = {
+    F_PALETTE_CONTROL, F_SCANLINES, F_OUTPUT_INVERT, F_NTSC_COLOUR, F_NTSC_TYPE, F_NORMAL_SCALING, F_MODE7_SCALING, F_CROP_BORDER,
+    F_SCREENCAP_SIZE, F_BORDER_COLOUR, F_SWAP_ASPECT, F_INTEGER_ASPECT, F_HDMI_MODE_STANDBY, F_FFOSD, F_AUTO_SWITCH
+};
+
+static fb_params_key_t fb_params_key;
+static int fb_params_valid = 0;
+static capture_info_t fb_params_capinfo;
+static int fb_params_scale[4];
+static int fb_params_overscan[4];
+
+static void geometry_calculate_fb_params(capture_info_t *capinfo);
+
 void geometry_get_fb_params(capture_info_t *capinfo) {
+    fb_params_key_t key;
+    memset(&key, 0, sizeof(key));
+    key.capinfo = *capinfo;
+    key.geometry = *geometry;
+    key.modeset = modeset;
+    key.scaling = scaling;
+    key.prescale = prescale;
+    key.use_px_sampling = use_px_sampling;
+    for (int i = 0; i < NUM_FB_PARAMS_PARAMETERS; i++) {
+        key.parameters[i] = get_parameter(fb_params_parameters[i]);
+    }
+    key.hdisplay = get_hdisplay();
+    key.vdisplay = get_vdisplay();
+    key.true_vdisplay = get_true_vdisplay();
+    key.startup_overscan = get_startup_overscan();
+    get_config_overscan(&key.overscan[0], &key.overscan[1], &key.overscan[2], &key.overscan[3]);
+    key.delay = cpld->get_delay();
+    key.sync_edge = cpld->get_sync_edge();
+    key.ntscphase = get_adjusted_ntscphase();
+    key.lines_per_vsync = get_lines_per_vsync(1);
+    key.vsync_width_lines = get_vsync_width_lines();
+    key.core_1_available = get_core_1_available();
+    key.osd_active = osd_active();
+    key.menu_active = menu_active();
+
+    if (fb_params_valid && memcmp(&key, &fb_params_key, sizeof(key)) == 0) {
+        *capinfo = fb_params_capinfo;
+        caphscale = fb_params_scale[0];
+        capvscale = fb_params_scale[1];
+        fhaspect = fb_params_scale[2];
+        fvaspect = fb_params_scale[3];
+        set_config_overscan(fb_params_overscan[0], fb_params_overscan[1], fb_params_overscan[2], fb_params_overscan[3]);
+    } else {
+        geometry_calculate_fb_params(capinfo);
+
+        fb_params_key = key;
+        fb_params_capinfo = *capinfo;
+        fb_params_scale[0] = caphscale;
+        fb_params_scale[1] = capvscale;
+        fb_params_scale[2] = fhaspect;
+        fb_params_scale[3] = fvaspect;
+        get_config_overscan(&fb_params_overscan[0], &fb_params_overscan[1], &fb_params_overscan[2], &fb_params_overscan[3]);
+        fb_params_valid = 1;
+    }
+    // not part of the cached result: the hsync threshold follows the cpu clock, hsync width and vsync type,
+    // which can change without changing anything in the key
+    calculate_cpu_timings();
+}
+
+static void geometry_calculate_fb_params(capture_info_t *capinfo) {
     int top = 0;
     int bottom = 0;
     int left = 0;
@@ -382,6 +491,12 @@ void geometry_get_fb_params(capture_info_t *capinfo) {
     }
 
     capinfo->sizex2 = geometry->fb_sizex2;
+    if (prescale && scaling != GSCALING_INTEGER) {
+        // sharp interpolation: prescale by the largest integer factor that fits the display so the soft GPU
+        // filter only blends the edges of each pixel. The capture line doubling is the prescaler so that is
+        // at most 2x, it is dropped below if it doesn't fit both ways
+        capinfo->sizex2 |= SIZEX2_DOUBLE_WIDTH | SIZEX2_DOUBLE_HEIGHT;
+    }
     switch(geometry->fb_bpp) {
         case BPP_4:
            capinfo->bpp = 4;
@@ -442,14 +557,17 @@ void geometry_get_fb_params(capture_info_t *capinfo) {
         capinfo->sizex2 &= SIZEX2_DOUBLE_WIDTH;  //inhibit double height for Atari 800 in 8bpp mode
     }
 
+    int forced_double_height = 0;
     if ((capinfo->detected_sync_type & SYNC_BIT_INTERLACED) && capinfo->video_type != VIDEO_PROGRESSIVE) {
         capinfo->sizex2 |= SIZEX2_DOUBLE_HEIGHT;
+        forced_double_height = 1;
     } else {
         if (get_parameter(F_SCANLINES) && !(menu_active() || osd_active())) {
             if ((capinfo->sizex2 & SIZEX2_DOUBLE_HEIGHT) == 0) {
                 capinfo->sizex2 |= SIZEX2_BASIC_SCANLINES;      //flag basic scanlines
             }
             capinfo->sizex2 |= SIZEX2_DOUBLE_HEIGHT;    // force double height
+            forced_double_height = 1;
         }
     }
 
@@ -595,6 +713,15 @@ void geometry_get_fb_params(capture_info_t *capinfo) {
     if ((geometry_min_v_height << double_height) > v_size43) {
         double_height = 0;
     }
+    if (prescale && scaling != GSCALING_INTEGER && !(double_width && double_height)) {
+        // a 2x1 or 1x2 prescale isn't an integer factor so drop the doubling the sharp interpolation added
+        if ((geometry->fb_sizex2 & SIZEX2_DOUBLE_WIDTH) == 0) {
+            double_width = 0;
+        }
+        if ((geometry->fb_sizex2 & SIZEX2_DOUBLE_HEIGHT) == 0 && !forced_double_height) {
+            double_height = 0;
+        }
+    }
     if (double_height && (capinfo->sizex2 & SIZEX2_BASIC_SCANLINES)) {
         capinfo->sizex2 = double_height | (double_width << 1) | SIZEX2_BASIC_SCANLINES;
     } else {
@@ -899,7 +1026,6 @@ void geometry_get_fb_params(capture_info_t *capinfo) {
         }
     }
     //log_info("Final aspect2: %dx%d, %dx%d, %dx%d", h_aspect, v_aspect, hscale, vscale, caphscale, capvscale);
-    calculate_cpu_timings();
     //log_info("size= %d, %d, %d, %d, %d, %d, %d",capinfo->chars_per_line, capinfo->nlines, geometry_min_h_width, geometry_min_v_height,capinfo->width,  capinfo->height, capinfo->sizex2);
 
     if (geometry->video_type == VIDEO_LINE_DOUBLED && (capinfo->sizex2 & SIZEX2_DOUBLE_HEIGHT) != 0) {
@@ -79,6 +79,9 @@ void        geometry_get_fb_params(capture_info_t *capinfo);
 void        geometry_get_clk_params(clk_info_t *clkinfo);
 void set_gscaling(int value);
 int get_gscaling();
+void set_gprescale(int value);
+int get_gprescale();
+int get_gprescale_available();
 int get_hscale();
 int get_vscale();
 int get_haspect();
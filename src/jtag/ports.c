@@ -14,40 +14,59 @@
 #include "ports.h"
 #include "../defs.h"
 #include "../rpi-gpio.h"
+#include "../rpi-mailbox-interface.h"
+#include "../info.h"
 #include "../fatfs/ff.h"
 #include "../rgb_to_fb.h"
 #include "../rgb_to_hdmi.h"
 
 unsigned char *xsvf_data;
 
+#define TCK_MASK (1 << TCK_PIN)
+#define TMS_MASK (1 << TMS_PIN)
+#define TDI_MASK (1 << TDI_PIN)
+#define TDO_MASK (1 << TDO_PIN)
+
+/* TMS and TDI as they will be driven on the next rising edge of TCK */
+static uint32_t tms_tdi_state = 0;
+
+/* edge delays converted to cycles at the current cpu speed */
+static int short_delay;
+static int long_delay;
+
+/* initPorts:  Precompute the edge delays so the per edge work is just */
+/*             GPSET0/GPCLR0 writes. Call before xsvfExecute()         */
+void initPorts()
+{
+   RPI_GpioBase = (rpi_gpio_t*) RPI_GPIO_BASE;
+   tms_tdi_state = 0;
+   short_delay = (int) ((double) 500 * (double) (get_clock_rate(ARM_CLK_ID) / 1000000) / 1000);
+   long_delay = short_delay << 1;
+}
+
 /* setPort:  Implement to set the named JTAG signal (p) to the new value (v).*/
 /* if in debugging mode, then just set the variables */
 void setPort(short p,short val)
 {
-static short TMS_state = 0;
-static short TDI_state = 0;
-
    switch (p) {
    case TMS:
-      //RPI_SetGpioValue(TMS_PIN, val);
-      TMS_state = val;
+      tms_tdi_state = val ? (tms_tdi_state | TMS_MASK) : (tms_tdi_state & ~TMS_MASK);
       break;
    case TDI:
-      //RPI_SetGpioValue(TDI_PIN, val);
-      TDI_state = val;
+      tms_tdi_state = val ? (tms_tdi_state | TDI_MASK) : (tms_tdi_state & ~TDI_MASK);
       break;
    case TCK:
       if (val == 0) {
-          RPI_SetGpioValue(TCK_PIN, 0);
-          delay_in_arm_cycles_cpu_adjust(500);
+          RPI_GpioBase->GPCLR0 = TCK_MASK;
+          delay_in_arm_cycles(short_delay);
       } else {
-          RPI_SetGpioValue(TMS_PIN, TMS_state);
-          RPI_SetGpioValue(TDI_PIN, TDI_state);
-          delay_in_arm_cycles_cpu_adjust(500);
-          RPI_SetGpioValue(TCK_PIN, 1);
-          delay_in_arm_cycles_cpu_adjust(500);
-          RPI_SetGpioValue(TMS_PIN, 0);  //force termination off during reprogramming
-          delay_in_arm_cycles_cpu_adjust(1000);
+          RPI_GpioBase->GPSET0 = tms_tdi_state;
+          RPI_GpioBase->GPCLR0 = tms_tdi_state ^ (TMS_MASK | TDI_MASK);
+          delay_in_arm_cycles(short_delay);
+          RPI_GpioBase->GPSET0 = TCK_MASK;
+          delay_in_arm_cycles(short_delay);
+          RPI_GpioBase->GPCLR0 = TMS_MASK;  //force termination off during reprogramming
+          delay_in_arm_cycles(long_delay);
       }
       break;
    default:
@@ -76,7 +95,7 @@ void readByte(unsigned char *data)
 /* read the TDO bit from port */
 unsigned char readTDOBit()
 {
-   return RPI_GetGpioValue(TDO_PIN);
+   return (RPI_GpioBase->GPLEV0 & TDO_MASK) != 0;
 }
 
 /* waitTime:  Implement as follows: */
@@ -14,6 +14,9 @@
 #define TMS (short) 1
 #define TDI (short) 2
 
+/* precompute the GPIO masks and edge delays, call before playing an xsvf file */
+extern void initPorts();
+
 /* set the port "p" (TCK, TMS, or TDI) to val (0 or 1) */
 extern void setPort(short p, short val);
 
@@ -1,5 +1,8 @@
 #include <stdio.h>
 #include <stdint.h>
+#include <string.h>
+#include "../defs.h"
+#include "../cpld.h"
 #include "../filesystem.h"
 #include "../logging.h"
 #include "../osd.h"
@@ -18,6 +21,45 @@ static unsigned char xsvf_buffer[1024*1024];
 
 static char message[80];
 
+// FNV-1a hash of the xsvf image, used to recognise a file that has already been programmed
+static uint32_t xsvf_hash(unsigned char *data, unsigned int length) {
+   uint32_t hash = 0x811c9dc5;
+   for (unsigned int i = 0; i < length; i++) {
+      hash = (hash ^ data[i]) * 0x01000193;
+   }
+   return hash;
+}
+
+// The record holds the hash of the last file programmed followed by the version the CPLD reported
+// on the next boot. Returns the number of fields read (0 = no record, 1 = version not yet confirmed)
+static int read_programmed_record(uint32_t *hash, int *version_id) {
+   char record[32];
+   if (file_load(CPLD_PROGRAMMED_FILE, record, sizeof(record) - 1) == 0) {
+      return 0;
+   }
+   unsigned int h;
+   unsigned int v;
+   int fields = sscanf(record, "%x %x", &h, &v);
+   if (fields >= 1) {
+      *hash = h;
+   }
+   if (fields >= 2) {
+      *version_id = v;
+   }
+   return fields < 0 ? 0 : fields;
+}
+
+// Called at boot once the CPLD has been identified to confirm which version the last programmed file produced
+void update_cpld_record_version(int version_id) {
+   uint32_t hash;
+   int recorded_version;
+   if (read_programmed_record(&hash, &recorded_version) == 1) {
+      sprintf(message, "%08x %03x\r\n", (unsigned int) hash, version_id);
+      file_save_bin(CPLD_PROGRAMMED_FILE, message, strlen(message));
+      log_info("CPLD programmed record confirmed: %s", message);
+   }
+}
+
 int update_cpld(char *path, int show_message) {
 
    FRESULT result;
@@ -28,33 +70,61 @@ int update_cpld(char *path, int show_message) {
    result = f_stat(path, &xsvf_info);
    if (result != FR_OK) {
       log_warn("Failed to stat xsvf file %s (result = %d)", path, result);
+      close_filesystem();
       return 10;
    }
 
    result = f_open(&xsvf_file, path, FA_READ);
    if (result != FR_OK) {
       log_warn("Failed to open xsvf file %s (result = %d)", path, result);
+      close_filesystem();
       return 11;
    }
 
    result = f_read(&xsvf_file, xsvf_buffer, xsvf_info.fsize, &num_read);
    if (result != FR_OK) {
       log_warn("Failed to read xsvf file %s (result = %d)", path, result);
+      close_filesystem();
       return 12;
    }
 
    if (num_read != xsvf_info.fsize) {
       log_warn("Read incorrect amount of data (%d vs %d)", num_read, xsvf_info.fsize);
+      close_filesystem();
       return 13;
    }
 
    result = f_close(&xsvf_file);
    if (result != FR_OK) {
       log_warn("Failed to close xsvf file %s (result = %d)", path, result);
+      close_filesystem();
       return 14;
    }
 
+   int blank = strcmp(path, BLANK_FILE) == 0;
+   uint32_t hash = xsvf_hash(xsvf_buffer, num_read);
+   uint32_t recorded_hash;
+   int recorded_version;
+   if (blank) {
+      file_delete(CPLD_PROGRAMMED_FILE);
+   } else if (read_programmed_record(&recorded_hash, &recorded_version) == 2
+              && recorded_hash == hash && recorded_version == cpld->get_version()) {
+      // the CPLD already holds this file so skip the erase and program and go back to the menu
+      close_filesystem();
+      log_info("CPLD already programmed with %s (hash = %08x)", path, (unsigned int) hash);
+      if (show_message) {
+          osd_set_clear(1, 0, "Already up to date");
+      }
+      return XSVF_ERROR_NONE;
+   }
+
    close_filesystem();
+
+   // the record is only written back once programming succeeds so a failed or interrupted
+   // program can't be mistaken for an up to date CPLD next time
+   if (!blank) {
+      file_delete(CPLD_PROGRAMMED_FILE);
+   }
    RPI_SetGpioPinFunction(MUX_PIN,      FS_OUTPUT);
 
    log_info("Read xsvf file %s (length = %d)", path, xsvf_info.fsize);
@@ -62,6 +132,7 @@ int update_cpld(char *path, int show_message) {
    RPI_SetGpioPinFunction(TDO_PIN, FS_INPUT);
    xsvf_iDebugLevel = 1;
    xsvf_data = xsvf_buffer;
+   initPorts();
    int xsvf_ret = xsvfExecute();
    RPI_SetGpioPinFunction(TDO_PIN, FS_OUTPUT);
 
@@ -72,6 +143,10 @@ int update_cpld(char *path, int show_message) {
       log_info(message);
       osd_set_clear(1, 0, message);
    } else {
+      if (!blank) {
+          sprintf(message, "%08x\r\n", (unsigned int) hash);
+          file_save_bin(CPLD_PROGRAMMED_FILE, message, strlen(message));
+      }
       if (show_message) {
           for (int i = 5; i > 0; i--) {
              sprintf(message, "Successful, rebooting in %d secs ", i);
@@ -6,5 +6,6 @@
 extern unsigned char *xsvf_data;
 
 int update_cpld(char *path, int show_message);
+void update_cpld_record_version(int version_id);
 
 #endif
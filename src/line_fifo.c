@@ -0,0 +1,57 @@
+#include <stdint.h>
+#include "defs.h"
+#include "startup.h"
+#include "osd.h"
+#include "scanline.h"
+#include "line_fifo.h"
+
+// Line FIFO between the capture on core 0 and the colour correction on core 1
+//
+// With the 12bpp colour correction LUT enabled the capture only stores the raw pixels read from the GPIO
+// into the next slot (see LINE_FIFO_SLOT / LINE_FIFO_PUSH in macros.S) so it isn't held up by the LUT
+// lookups while psync is running. Core 1 then looks up each pixel in palette_data_4096 and writes the
+// line into the frame buffer. Core 0 only writes the head and core 1 only writes the tail. If core 1
+// falls a whole FIFO behind the capture does the LUT lookups itself for that line rather than stalling
+// or dropping it, and core 0 waits for the FIFO to empty before the field is displayed. The CRT mask
+// (see scanline.c) is only applied here as it depends on the column.
+//
+// Only the 12bpp colour corrected capture uses the FIFO as it is the only kernel with a per pixel
+// lookup that holds up the psync loop, the others just shift and mask the GPIO into the frame buffer.
+
+volatile int line_fifo_head;
+volatile int line_fifo_tail;
+uint32_t line_fifo_raw[LINE_FIFO_DEPTH][(1 << LINE_FIFO_SLOT_SHIFT) / 4] __attribute__((aligned(32)));
+line_fifo_line_t line_fifo_lines[LINE_FIFO_DEPTH];
+
+// Runs on core 1
+void line_fifo_process() {
+   while (line_fifo_tail != line_fifo_head) {
+      _data_memory_barrier();
+      int slot = line_fifo_tail & (LINE_FIFO_DEPTH - 1);
+      uint32_t *raw = line_fifo_raw[slot];
+      uint32_t *dest = line_fifo_lines[slot].dest;
+      int words = (line_fifo_lines[slot].psyncs >> 3) << 2;   // the capture stores 4 words per 8 psyncs
+      if (scanline_mask_enabled) {
+         // each word holds two pixels so the three columns of the mask repeat every three words
+         for (int i = 0; i < words; i++) {
+            uint32_t pixels = raw[i];
+            int column = (i % 3) * 2;
+            dest[i] = scanline_mask_4096[column % 3][pixels & 0xfff] | (scanline_mask_4096[(column + 1) % 3][(pixels >> 16) & 0xfff] << 16);
+         }
+      } else {
+         for (int i = 0; i < words; i++) {
+            uint32_t pixels = raw[i];
+            dest[i] = palette_data_4096[pixels & 0xfff] | (palette_data_4096[(pixels >> 16) & 0xfff] << 16);
+         }
+      }
+      _data_memory_barrier();
+      line_fifo_tail = line_fifo_tail + 1;
+   }
+}
+
+// Runs on core 0, returns once core 1 has written every queued line into the frame buffer
+void line_fifo_drain() {
+   while (line_fifo_tail != line_fifo_head) {
+   }
+   _data_memory_barrier();
+}
@@ -0,0 +1,22 @@
+// line_fifo.h
+
+#ifndef LINE_FIFO_H
+#define LINE_FIFO_H
+
+#include <stdint.h>
+#include "defs.h"
+
+typedef struct {
+   uint32_t *dest;               // frame buffer line
+   int psyncs;                   // psyncs captured, one pixel per psync
+} line_fifo_line_t;
+
+extern volatile int line_fifo_head;
+extern volatile int line_fifo_tail;
+extern uint32_t line_fifo_raw[LINE_FIFO_DEPTH][(1 << LINE_FIFO_SLOT_SHIFT) / 4];
+extern line_fifo_line_t line_fifo_lines[LINE_FIFO_DEPTH];
+
+void line_fifo_process();
+void line_fifo_drain();
+
+#endif
@@ -3,77 +3,115 @@
 #include <stdint.h>
 #include "logging.h"
 #include "filesystem.h"
+#include "startup.h"
+#include "rpi-aux.h"
+#include "field_tasks.h"
 
 #define BUFFER_LENGTH 256*1024
 #define BUFFER_THRESHOLD (BUFFER_LENGTH - 256)
+#define LOG_FLUSH_DEADLINE 50   // fields the deferred output may wait for enough blanking time
 static char log_buffer[BUFFER_LENGTH];
 static int log_pointer = 0;
+static int log_sent = 0;        // how much of the buffer has been written to the UART
+static int log_deferred = 0;
+
+static int log_flush_task(uint32_t budget);
+
+static field_task_t log_task = {
+   .run = log_flush_task,
+   .priority = 0,
+   .deadline = LOG_FLUSH_DEADLINE
+};
 
 void log_save(char *filename) {
     file_save_bin(filename, log_buffer, log_pointer);
 }
 
+static void log_flush() {
+   while (log_sent < log_pointer) {
+      RPI_AuxMiniUartWrite(log_buffer[log_sent++]);
+   }
+}
+
+// Runs in the vertical blanking, each character takes ~87us at 115200 baud once the 8 char FIFO is full
+static int log_flush_task(uint32_t budget) {
+   uint32_t start = _get_cycle_counter();
+   while (log_sent < log_pointer) {
+      RPI_AuxMiniUartWrite(log_buffer[log_sent++]);
+      if (_get_cycle_counter() - start >= budget) {
+         break;
+      }
+   }
+   return log_sent < log_pointer;
+}
+
+// While deferred (during capture) the UART output is left in the buffer and written out in the vertical blanking
+void log_defer(int defer) {
+   log_deferred = defer;
+   if (!defer) {
+      log_flush();
+   }
+}
+
+static void log_emit(int now) {
+   if (log_pointer > BUFFER_THRESHOLD) {
+      log_flush();
+      log_pointer = 0;
+      log_sent = 0;
+   } else if (log_deferred && !now) {
+      field_task_schedule(&log_task);
+   } else {
+      log_flush();
+   }
+}
+
 #ifdef DEBUG
 void log_debug(const char *fmt, ...) {
    va_list ap;
-   printf("DEBUG: ");
    log_pointer += sprintf(log_buffer + log_pointer, "DEBUG: ");
    va_start(ap, fmt);
-   vprintf(fmt, ap);
    log_pointer += vsprintf(log_buffer + log_pointer, fmt, ap);
    log_pointer += sprintf(log_buffer + log_pointer, "\r\n");
-   log_pointer = log_pointer > BUFFER_THRESHOLD ? 0 : log_pointer;
    va_end(ap);
-   printf("\r\n");
+   log_emit(0);
 }
 #endif
 
 void log_info(const char *fmt, ...) { //can print up to 6 chars very fast (8 char tx fifo buffer minus CR/LF) - assumes buffer is already empty
    va_list ap;
    va_start(ap, fmt);
-   vprintf(fmt, ap);
    log_pointer += vsprintf(log_buffer + log_pointer, fmt, ap);
    log_pointer += sprintf(log_buffer + log_pointer, "\r\n");
-   log_pointer = log_pointer > BUFFER_THRESHOLD ? 0 : log_pointer;
    va_end(ap);
-   printf("\r\n");
+   log_emit(0);
 }
 
 void log_warn(const char *fmt, ...) {
    va_list ap;
-   printf("WARN: ");
    log_pointer += sprintf(log_buffer + log_pointer, "WARN: ");
    va_start(ap, fmt);
-   vprintf(fmt, ap);
    log_pointer += vsprintf(log_buffer + log_pointer, fmt, ap);
    log_pointer += sprintf(log_buffer + log_pointer, "\r\n");
-   log_pointer = log_pointer > BUFFER_THRESHOLD ? 0 : log_pointer;
    va_end(ap);
-   printf("\r\n");
+   log_emit(0);
 }
 
 void log_error(const char *fmt, ...) {
    va_list ap;
-   printf("ERROR: ");
    log_pointer += sprintf(log_buffer + log_pointer, "ERROR: ");
    va_start(ap, fmt);
-   vprintf(fmt, ap);
    log_pointer += vsprintf(log_buffer + log_pointer, fmt, ap);
    log_pointer += sprintf(log_buffer + log_pointer, "\r\n");
-   log_pointer = log_pointer > BUFFER_THRESHOLD ? 0 : log_pointer;
    va_end(ap);
-   printf("\r\n");
+   log_emit(1);
 }
 
 void log_fatal(const char *fmt, ...) {
    va_list ap;
-   printf("FATAL: ");
    log_pointer += sprintf(log_buffer + log_pointer, "FATAL: ");
    va_start(ap, fmt);
-   vprintf(fmt, ap);
    log_pointer += vsprintf(log_buffer + log_pointer, fmt, ap);
    log_pointer += sprintf(log_buffer + log_pointer, "\r\n");
-   log_pointer = log_pointer > BUFFER_THRESHOLD ? 0 : log_pointer;
    va_end(ap);
-   printf("\r\n");
+   log_emit(1);
 }
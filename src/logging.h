@@ -5,6 +5,8 @@
 
 extern void log_save(char *filename);
 
+extern void log_defer(int defer);
+
 #ifdef DEBUG
 extern void log_debug(const char *fmt, ...);
 #else
@@ -0,0 +1,108 @@
+#include <stdint.h>
+#include "defs.h"
+#include "startup.h"
+#include "multicore.h"
+
+// Job queues for the worker cores
+//
+// Core 0 runs the capture and is the only core that submits jobs. Each worker core (1-3) has its own
+// single producer, single consumer ring so neither side needs an atomic read-modify-write: core 0 only
+// writes the head and the worker only writes the tail, each in its own cache line. A job goes to the
+// least loaded worker and the worker is woken with SEV. Workers SEV as each job completes so core 0 can
+// WFE in multicore_barrier. Without any workers (Pi 0/1 or multicore disabled) jobs run immediately on
+// core 0.
+//
+// Core 1 also services start_core_1_code (the CGA artifact decode and the line FIFO) so higher cores are preferred.
+
+typedef struct {
+   job_fn fn;
+   int arg;
+   int pad[6];
+} __attribute__((aligned(32))) job_t;
+
+typedef struct {
+   volatile int head;               // written by core 0
+   int pad0[7];
+   volatile int tail;               // written by the worker core
+   int pad1[7];
+   job_t jobs[MULTICORE_QUEUE_SIZE];
+} __attribute__((aligned(32))) job_queue_t;
+
+static job_queue_t queues[4];
+static volatile int worker_ready[4];
+
+// Called on each worker core once its MMU and caches are enabled
+void multicore_register(int core) {
+   worker_ready[core] = 1;
+}
+
+int multicore_workers() {
+   int workers = 0;
+   for (int core = 1; core < 4; core++) {
+      workers += worker_ready[core];
+   }
+   return workers;
+}
+
+void multicore_submit(job_fn fn, int arg) {
+   job_queue_t *best = 0;
+   int best_pending = MULTICORE_QUEUE_SIZE - 1;
+   for (int core = 3; core >= 1; core--) {
+      if (worker_ready[core]) {
+         int pending = (queues[core].head - queues[core].tail) & (MULTICORE_QUEUE_SIZE - 1);
+         if (pending < best_pending) {
+            best = &queues[core];
+            best_pending = pending;
+         }
+      }
+   }
+   if (!best) {
+      fn(arg);                     // no worker or all queues full
+      return;
+   }
+   job_t *job = &best->jobs[best->head];
+   job->fn = fn;
+   job->arg = arg;
+   _data_memory_barrier();
+   best->head = (best->head + 1) & (MULTICORE_QUEUE_SIZE - 1);
+   _data_memory_barrier();
+   asm volatile ("sev");
+}
+
+int multicore_idle() {
+   for (int core = 1; core < 4; core++) {
+      if (queues[core].head != queues[core].tail) {
+         return 0;
+      }
+   }
+   return 1;
+}
+
+void multicore_barrier() {
+   while (!multicore_idle()) {
+      asm volatile ("wfe");
+   }
+   _data_memory_barrier();
+}
+
+// Runs on a worker core
+void multicore_poll(int core) {
+   job_queue_t *queue = &queues[core];
+   while (queue->tail != queue->head) {
+      _data_memory_barrier();
+      job_t *job = &queue->jobs[queue->tail];
+      job->fn(job->arg);
+      _data_memory_barrier();
+      queue->tail = (queue->tail + 1) & (MULTICORE_QUEUE_SIZE - 1);
+      _data_memory_barrier();
+      asm volatile ("sev");
+   }
+}
+
+// Cores 2 and 3 stay here, core 1 polls its queue from run_core_loop
+void multicore_worker(int core) {
+   while (1) {
+      asm volatile ("wfe");
+      multicore_poll(core);
+   }
+}
@@ -0,0 +1,16 @@
+// multicore.h
+
+#ifndef MULTICORE_H
+#define MULTICORE_H
+
+typedef void (*job_fn)(int arg);
+
+void multicore_register(int core);
+int multicore_workers();
+void multicore_submit(job_fn fn, int arg);
+int multicore_idle();
+void multicore_barrier();
+void multicore_poll(int core);
+void multicore_worker(int core);
+
+#endif
@@ -23,6 +23,7 @@
 #include "jtag/update_cpld.h"
 #include "startup.h"
 #include "vid_cga_comp.h"
+#include "scanline.h"
 #include <math.h>
 
 // =============================================================
@@ -177,12 +178,19 @@ static const char *deinterlace_names[] = {
    "Advanced Motion"
 };
 
+static const char *normal_deinterlace_names[] = {
+   "Weave",
+   "Simple Bob",
+   "Motion Adaptive"
+};
+
 #ifdef MULTI_BUFFER
 static const char *nbuffer_names[] = {
    "1",
    "2",
    "3",
-   "4"
+   "4",
+   "1 (Beam Race)"
 };
 #endif
 
@@ -217,6 +225,17 @@ static const char *colour_names[] = {
    "Amber"
 };
 
+static const char *scanline_style_names[] = {
+   "Flat",
+   "Brightness Weighted",
+   "Linear Light"
+};
+
+static const char *crt_mask_names[] = {
+   "None",
+   "Aperture Grille"
+};
+
 static const char *invert_names[] = {
    "Normal",
    "Invert RGB/YUV",
@@ -231,7 +250,9 @@ static const char *scaling_names[] = {
    "Interpolate 4:3/Soft",
    "Interpolate 4:3/Softer",
    "Interpolate Full/Soft",
-   "Interpolate Full/Softer"
+   "Interpolate Full/Softer",
+   "Interpolate 4:3/Sharp",
+   "Interpolate Full/Sharp"
 };
 
 static const char *frontend_names_6[] = {
@@ -429,6 +450,8 @@ static param_t features[] = {
    {       F_OUTPUT_INVERT,     "Output Invert",     "output_invert", 0,       NUM_INVERT - 1, 1 },
    {           F_SCANLINES,         "Scanlines",         "scanlines", 0,                    1, 1 },
    {      F_SCANLINE_LEVEL,    "Scanline Level",    "scanline_level", 0,                   14, 1 },
+   {      F_SCANLINE_STYLE,    "Scanline Style",    "scanline_style", 0, NUM_SCANLINE_STYLES - 1, 1 },
+   {            F_CRT_MASK,          "CRT Mask",          "crt_mask", 0,     NUM_CRTMASKS - 1, 1 },
    {         F_CROP_BORDER,"Crop Border (Zoom)",       "crop_border", 0,     NUM_OVERSCAN - 1, 1 },
    {      F_SCREENCAP_SIZE,    "ScreenCap Size",    "screencap_size", 0,    NUM_SCREENCAP - 1, 1 },
    {           F_FONT_SIZE,         "Font Size",         "font_size", 0,     NUM_FONTSIZE - 1, 1 },
@@ -439,7 +462,7 @@ static param_t features[] = {
    {       F_GENLOCK_SPEED,     "Genlock Speed",     "genlock_speed", 0,NUM_GENLOCK_SPEED - 1, 1 },
    {      F_GENLOCK_ADJUST,    "Genlock Adjust",    "genlock_adjust", 0,NUM_GENLOCK_ADJUST - 1, 1 },
 #ifdef MULTI_BUFFER
-   {         F_NUM_BUFFERS,       "Num Buffers",       "num_buffers", 0,                    3, 1 },
+   {         F_NUM_BUFFERS,       "Num Buffers",       "num_buffers", 0,    BEAM_RACE_BUFFERS, 1 },
 #endif
    {     F_RETURN_POSITION,   "Return Position",            "return", 0,                    1, 1 },
    {               F_DEBUG,             "Debug",             "debug", 0,                    1, 1 },
@@ -740,6 +763,8 @@ static param_menu_item_t ffosd_ref           = { I_FEATURE, &features[F_FFOSD]
 static param_menu_item_t stretch_ref         = { I_FEATURE, &features[F_SWAP_ASPECT]        };
 static param_menu_item_t scanlines_ref       = { I_FEATURE, &features[F_SCANLINES]      };
 static param_menu_item_t scanlinesint_ref    = { I_FEATURE, &features[F_SCANLINE_LEVEL]   };
+static param_menu_item_t scanlinestyle_ref   = { I_FEATURE, &features[F_SCANLINE_STYLE]   };
+static param_menu_item_t crtmask_ref         = { I_FEATURE, &features[F_CRT_MASK]         };
 static param_menu_item_t colour_ref          = { I_FEATURE, &features[F_OUTPUT_COLOUR]         };
 static param_menu_item_t invert_ref          = { I_FEATURE, &features[F_OUTPUT_INVERT]         };
 static param_menu_item_t fontsize_ref        = { I_FEATURE, &features[F_FONT_SIZE]       };
@@ -862,6 +887,8 @@ static menu_t preferences_menu = {
       (base_menu_item_t *) &back_ref,
       (base_menu_item_t *) &scanlines_ref,
       (base_menu_item_t *) &scanlinesint_ref,
+      (base_menu_item_t *) &scanlinestyle_ref,
+      (base_menu_item_t *) &crtmask_ref,
       (base_menu_item_t *) &stretch_ref,
       (base_menu_item_t *) &overscan_ref,
       (base_menu_item_t *) &m7deinterlace_ref,
@@ -1122,6 +1149,10 @@ static char selected_manufacturer[MAX_STRING_SIZE];
 static int active = 0;
 static int old_active = -1;
 
+// Palette staged for the next Pi vertical blank (see osd_apply_pending_palette)
+static volatile int palette_pending = 0;
+static int pending_active = 0;
+
 // Main state of the OSD
 osd_state_t osd_state = IDLE;
 
@@ -1212,6 +1243,40 @@ typedef struct {
 
 static autoswitch_info_t autoswitch_info[MAX_SUB_PROFILES];
 
+// Sub-profiles sorted on (sync_type, lower_limit) with a running maximum of upper_limit within
+// each sync_type so autoswitch_detect can binary search rather than test every sub-profile
+static int autoswitch_index[MAX_SUB_PROFILES];
+static int autoswitch_max_upper[MAX_SUB_PROFILES];
+static int autoswitch_index_count = 0;
+
+// A profile buffer pre-parsed into the setter calls that process_single_profile would make,
+// so switching sub-profile does not re-tokenise the profile text
+enum {
+   PROFILE_SET_CPLD,
+   PROFILE_SET_GEOMETRY,
+   PROFILE_SET_FEATURE
+};
+
+#define MAX_PROFILE_SETTINGS 256
+
+typedef struct {
+   unsigned char type;
+   unsigned char set;
+   short key;
+   int value;
+} profile_setting_t;
+
+typedef struct {
+   int empty;
+   int has_options;     // keymap etc. present, these are still read from the profile text
+   int num_settings;
+   profile_setting_t settings[MAX_PROFILE_SETTINGS];
+} parsed_profile_t;
+
+static parsed_profile_t parsed_default;
+static parsed_profile_t parsed_sub_default;
+static parsed_profile_t parsed_sub_profiles[MAX_SUB_PROFILES];
+
 static char cpld_firmware_dir[MIN_STRING_SIZE] = DEFAULT_CPLD_FIRMWARE_DIR;
 
 // =============================================================
@@ -1247,6 +1312,9 @@ void set_menu_table() {
       if (!any_DAC_detected()) {
           features[F_PALETTE_CONTROL].max = PALETTECONTROL_NTSCARTIFACT_BW_AUTO;
       }
+      if (!get_gprescale_available()) {
+          features[F_SCALING].max = SCALING_FILLALL_VERY_SOFT;    // the sharp modes can't prescale both ways
+      }
       switch (_get_hardware_id()) {
         case 4:                                  //pi 4
           features[F_OVERCLOCK_CPU].max = 200;
@@ -1560,6 +1628,9 @@ static void set_feature(int num, int value) {
    case F_NTSC_COLOUR:
    case F_OUTPUT_COLOUR:
    case F_OUTPUT_INVERT:
+   case F_SCANLINE_LEVEL:
+   case F_SCANLINE_STYLE:
+   case F_CRT_MASK:
    case F_PAL_ODD_LEVEL:
    case F_PAL_ODD_LINE:
       set_parameter(num, value);
@@ -1706,6 +1777,10 @@ static const char *get_param_string(param_menu_item_t *param_item) {
          return colour_names[value];
       case F_OUTPUT_INVERT:
          return invert_names[value];
+      case F_SCANLINE_STYLE:
+         return scanline_style_names[value];
+      case F_CRT_MASK:
+         return crt_mask_names[value];
       case F_FONT_SIZE:
          return fontsize_names[value];
       case F_PALETTE:
@@ -1715,8 +1790,9 @@ static const char *get_param_string(param_menu_item_t *param_item) {
       case F_AUTO_SWITCH:
          return autoswitch_names[value];
       case F_MODE7_DEINTERLACE:
-      case F_NORMAL_DEINTERLACE:
          return deinterlace_names[value];
+      case F_NORMAL_DEINTERLACE:
+         return normal_deinterlace_names[value];
       case F_MODE7_SCALING:
          return even_scaling_names[value];
       case F_NORMAL_SCALING:
@@ -1918,6 +1994,27 @@ static void info_system_summary(int line) {
    osd_set(line++, 0, message);
    sprintf(message, "SDRAM_I Voltage: %6.2f V", get_voltage(COMPONENT_SDRAM_I));
    osd_set(line++, 0, message);
+   int line_ns = get_one_line_time_ns();
+   int phase_ns = get_vsync_phase_ns();
+   if (line_ns > 0 && phase_ns >= 0) {
+      sprintf(message, "    Vsync Phase: %6d us (%d.%02d lines)", phase_ns / 1000, phase_ns / line_ns, (phase_ns % line_ns) * 100 / line_ns);
+      osd_set(line++, 0, message);
+   }
+#ifdef MULTI_BUFFER
+   if (get_parameter(F_NUM_BUFFERS) == BEAM_RACE_BUFFERS) {
+      int gap = get_beam_race_gap();
+      if (gap >= 0) {
+         sprintf(message, "   Beam Latency: %6d us (%d lines)", gap * line_ns / 1000, gap);
+      } else {
+         sprintf(message, "   Beam Latency: Double buffered");
+      }
+      osd_set(line++, 0, message);
+   }
+   if (get_frame_pacing_judder() >= 0) {
+      sprintf(message, "   Frame Pacing: %6d judder/s", get_frame_pacing_judder());
+      osd_set(line++, 0, message);
+   }
+#endif
 }
 
 static void info_help_quickstart(int line) {
@@ -2701,6 +2798,65 @@ int colodore_gamma_correct(double value) {
     *mono = colodore_gamma_correct(y);
 }
 
+// Internal NTSC artifact colours as R, G, B, Y in 0-255 scaled by 256 (8 fractional bits)
+// These are the YUV values below converted to RGB after the per colour hue shift:
+//
+//  colour  Y     U     V    shift
+//  0x00    0     0     0     0     Black
+//  0x01    0.25  0     0.5   6     Magenta
+//  0x02    0.25  0.5   0     12    Dark Blue
+//  0x03    0.5   1     1    -6     Purple
+//  0x04    0.25  0    -0.5   12    Dark Green
+//  0x05    0.5   0     0     0     lower Gray
+//  0x06    0.5   1    -1    -6     Medium Blue
+//  0x07    0.75  0.5   0     6     Light Blue
+//  0x08    0.25 -0.5   0     12    Brown
+//  0x09    0.5  -1     1    -6     Orange
+//  0x0a    0.5   0     0     0     upper Gray
+//  0x0b    0.75  0     0.5   6     Pink
+//  0x0c    0.5  -1    -1    -6     Light Green
+//  0x0d    0.75 -0.5   0     6     Yellow
+//  0x0e    0.75  0    -0.5   6     Aquamarine
+//  0x0f    1     0     0     0     White
+//
+// R = Y + 1.140 * V, G = Y - 0.395 * U - 0.581 * V, B = Y + 2.032 * U
+static const int ntsc_artifact_rgby[16][4] = {
+   {      0,      0,      0,      0 },
+   {  53326,  -3888,  23253,  16320 },
+   {   8584,   7652,  81195,  16320 },
+   { 114430, -31993, 150697,  32640 },
+   { -20076,  37550,   2530,  16320 },
+   {  32640,  32640,  32640,  32640 },
+   { -33593,  38056, 178428,  32640 },
+   {  45071,  38120, 114921,  48960 },
+   {  24056,  24988, -48555,  16320 },
+   {  98873,  27224,-113148,  32640 },
+   {  32640,  32640,  32640,  32640 },
+   {  85966,  28752,  55893,  48960 },
+   { -49150,  97273, -85417,  32640 },
+   {  52849,  59800, -17001,  48960 },
+   {  11954,  69168,  42027,  48960 },
+   {  65280,  65280,  65280,  65280 }
+};
+
+// Brightness in percent indexed by filtered bitcount (1-3) and bitcount (0-4)
+static const int ntsc_artifact_level[3][5] = {
+   { 100, 100,  50,  33,  33 },
+   { 100, 125, 100,  66,  66 },
+   { 100, 150, 125, 100, 100 }
+};
+
+static int ntsc_artifact_component(int value, int level) {
+   value = (value * level / 100 + 128) >> 8;
+   return value < 0 ? 0 : (value > 255 ? 255 : value);
+}
+
+// Rotate the 4 bit artifact pattern to the NTSC phase so it indexes the colour tables
+static int ntsc_artifact_rotate(int colour) {
+   int phase = get_adjusted_ntscphase() & 3;
+   return ((colour << (4 - phase)) & 0x0f) | (colour >> phase);
+}
+
 int create_NTSC_artifact_colours(int index, int filtered_bitcount) {
     int colour = index & 0x0f;
     int bitcount = 0;
@@ -2708,246 +2864,86 @@ int create_NTSC_artifact_colours(int index, int filtered_bitcount) {
     if (colour & 2) bitcount++;
     if (colour & 4) bitcount++;
     if (colour & 8) bitcount++;
-    double Y = 0;
-    double U = 0;
-    double V = 0;
-    double R = 0;
-    double G = 0;
-    double B = 0;
-    colour = ((colour << (4 - (get_adjusted_ntscphase() & 3))) & 0x0f) | (colour >> (get_adjusted_ntscphase() & 3));
+    int R;
+    int G;
+    int B;
+    int Y = 0;
+    colour = ntsc_artifact_rotate(colour);
 
     if (ntsc_palette <= features[F_PALETTE].max) {
         if (colour > 7) colour += 8;
         int RGBY = palette_array[ntsc_palette][colour];
-        //if (colour < 0x18) log_info("Using %d, %x for NTSC palette %X",ntsc_palette,colour,  RGBY);
-        R = (double)(RGBY & 0xff) / 255.0f;
-        G = (double)((RGBY >> 8) & 0xff) / 255.0f;
-        B = (double)((RGBY >> 16) & 0xff) / 255.0f;
-
+        R = (RGBY & 0xff) << 8;
+        G = ((RGBY >> 8) & 0xff) << 8;
+        B = ((RGBY >> 16) & 0xff) << 8;
     } else {
-    //log_info("Using internal for NTSC palette");
-    double phase_shift = 0.0f;
-
-        switch (colour) {
-           case 0x00:
-              Y=0     ; U=0     ; V=0     ; break; //Black
-           case 0x01:
-              Y=0.25  ; U=0     ; V=0.5   ; phase_shift = 6.0f; break; //Magenta
-           case 0x02:
-              Y=0.25  ; U=0.5   ; V=0     ; phase_shift = 12.0f; break; //Dark Blue
-           case 0x03:
-              Y=0.5   ; U=1     ; V=1     ; phase_shift = -6.0f; break; //Purple
-           case 0x04:
-              Y=0.25  ; U=0     ; V=-0.5  ; phase_shift = 12.0f; break; //Dark Green
-           case 0x05:
-              Y=0.5   ; U=0     ; V=0     ; break; //lower Gray
-           case 0x06:
-              Y=0.5   ; U=1     ; V=-1    ; phase_shift = -6.0f; break; //Medium Blue
-           case 0x07:
-              Y=0.75  ; U=0.5   ; V=0     ; phase_shift = 6.0f; break; //Light Blue
-           case 0x08:
-              Y=0.25  ; U=-0.5  ; V=0     ; phase_shift = 12.0f; break; //Brown
-           case 0x09:
-              Y=0.5   ; U=-1    ; V=1     ; phase_shift = -6.0f; break; //Orange
-           case 0x0a:
-              Y=0.5   ; U=0     ; V=0     ; break; //upper Gray
-           case 0x0b:
-              Y=0.75  ; U=0     ; V=0.5   ; phase_shift = 6.0f; break; //Pink
-           case 0x0c:
-              Y=0.5   ; U=-1    ; V=-1    ; phase_shift = -6.0f; break; //Light Green
-           case 0x0d:
-              Y=0.75  ; U=-0.5  ; V=0     ; phase_shift = 6.0f; break; //Yellow
-           case 0x0e:
-              Y=0.75  ; U=0     ; V=-0.5  ; phase_shift = 6.0f; break; //Aquamarine
-           case 0x0f:
-              Y=1     ; U=0     ; V=0     ; break; //White
-        }
-
-        double hue = phase_shift * PI / 180.0f;
-
-        double U2 = (U * cos(hue) + V * sin(hue));
-        double V2 = (V * cos(hue) - U * sin(hue));
-
-        R = (Y + 1.140 * V2);
-        G = (Y - 0.395 * U2 - 0.581 * V2);
-        B = (Y + 2.032 * U2);
-
-    }
-
-    if (filtered_bitcount == 1) {
-
-        switch(bitcount) {
-            case 1:
-                R = R * 100 / 100;
-                G = G * 100 / 100;
-                B = B * 100 / 100;
-                break;
-            case 2:
-                R = R * 50 / 100;
-                G = G * 50 / 100;
-                B = B * 50 / 100;
-                break;
-            case 3:
-                R = R * 33 / 100;
-                G = G * 33 / 100;
-                B = B * 33 / 100;
-                break;
-            case 4:
-                R = R * 33 /100;
-                G = G * 33 /100;
-                B = B * 33 /100;
-                break;
-            default:
-                break;
-        }
-
-    }
-    if (filtered_bitcount == 2) {
-        switch(bitcount) {
-            case 1:
-                R = R * 125 / 100;
-                G = G * 125 / 100;
-                B = B * 125 / 100;
-                break;
-            case 2:
-                R = R * 100 / 100;
-                G = G * 100 / 100;
-                B = B * 100 / 100;
-                break;
-            case 3:
-                R = R * 66 / 100;
-                G = G * 66 / 100;
-                B = B * 66 / 100;
-                break;
-            case 4:
-                R = R * 66 /100;
-                G = G * 66 /100;
-                B = B * 66 /100;
-                break;
-            default:
-                break;
-        }
+        R = ntsc_artifact_rgby[colour][0];
+        G = ntsc_artifact_rgby[colour][1];
+        B = ntsc_artifact_rgby[colour][2];
+        Y = ntsc_artifact_rgby[colour][3];
     }
 
-    if (filtered_bitcount >= 3) {
-        switch(bitcount) {
-            case 1:
-                R = R * 150 / 100;
-                G = G * 150 / 100;
-                B = B * 150 / 100;
-                break;
-            case 2:
-                R = R * 125 / 100;
-                G = G * 125 / 100;
-                B = B * 125 / 100;
-                break;
-            case 3:
-                R = R * 100 / 100;
-                G = G * 100 / 100;
-                B = B * 100 / 100;
-                break;
-            case 4:
-                R = R * 100 /100;
-                G = G * 100 /100;
-                B = B * 100 /100;
-                break;
-            default:
-                break;
-        }
+    int level = 100;
+    if (filtered_bitcount >= 1) {
+        level = ntsc_artifact_level[(filtered_bitcount > 3 ? 3 : filtered_bitcount) - 1][bitcount];
     }
 
-    R = gamma_correct(R, 1);
-    G = gamma_correct(G, 1);
-    B = gamma_correct(B, 1);
-    Y = gamma_correct(Y, 1);
+    R = ntsc_artifact_component(R, level);
+    G = ntsc_artifact_component(G, level);
+    B = ntsc_artifact_component(B, level);
+    Y = ntsc_artifact_component(Y, 100);
 
-    return (int)R | ((int)G<<8) | ((int)B<<16) | ((int)Y<<24);
+    return R | (G << 8) | (B << 16) | (Y << 24);
 }
 
-int create_NTSC_artifact_colours_palette_320(int index) {
-    int colour = index & 0x0f;
-    int R = 0;
-    int G = 0;
-    int B = 0;
-
-    colour = ((colour << (4 - (get_adjusted_ntscphase() & 3))) & 0x0f) | (colour >> (get_adjusted_ntscphase() & 3));
-
-    if (index < 0x10) {
-        switch (colour) {
-           case 0x00:
-              R=0     ; G=0     ; B=0     ; break; //Black
-           case 0x08:
-              R=0     ; G=117   ; B=108   ; break;
-           case 0x01:
-              R=0     ; G=49    ; B=111   ; break;
-           case 0x09:
-              R=0     ; G=83    ; B=63    ; break;
-           case 0x02:
-              R=123   ; G=52    ; B=0     ; break;
-           case 0x0a:
-              R=57    ; G=190   ; B=66    ; break;
-           case 0x03:
-              R=131   ; G=118   ; B=73    ; break;
-           case 0x0b:
-              R=83    ; G=155   ; B=14    ; break;
-           case 0x04:
-              R=235   ; G=50    ; B=7     ; break;
-           case 0x0c:
-              R=210   ; G=196   ; B=153   ; break;
-           case 0x05:
-              R=248   ; G=122   ; B=155   ; break;
-           case 0x0d:
-              R=217   ; G=160   ; B=107   ; break;
-           case 0x06:
-              R=180   ; G=69    ; B=0     ; break;
-           case 0x0e:
-              R=139   ; G=208   ; B=74    ; break;
-           case 0x07:
-              R=190   ; G=133   ; B=80    ; break;
-           case 0x0f:
-              R=152   ; G=173   ; B=20    ; break;
-        }
-    } else {
-        switch (colour) {
-           case 0x00:
-              R=0     ; G=0     ; B=0     ; break; //Black
-           case 0x08:
-              R=0     ; G=139   ; B=172   ; break;
-           case 0x01:
-              R=0     ; G=73    ; B=174   ; break;
-           case 0x09:
-              R=0     ; G=158   ; B=232   ; break;
-           case 0x02:
-              R=89    ; G=28    ; B=0     ; break;
-           case 0x0a:
-              R=0     ; G=188   ; B=155   ; break;
-           case 0x03:
-              R=99    ; G=116   ; B=158   ; break;
-           case 0x0b:
-              R=0     ; G=206   ; B=217   ; break;
-           case 0x04:
-              R=237   ; G=28    ; B=39    ; break;
-           case 0x0c:
-              R=180   ; G=196   ; B=238   ; break;
-           case 0x05:
-              R=221   ; G=125   ; B=239   ; break;
-           case 0x0d:
-              R=188   ; G=210   ; B=255   ; break;
-           case 0x06:
-              R=255   ; G=73    ; B=0     ; break;
-           case 0x0e:
-              R=247   ; G=237   ; B=193   ; break;
-           case 0x07:
-              R=255   ; G=165   ; B=196   ; break;
-           case 0x0f:
-              R=255   ; G=255   ; B=255   ; break;
-        }
-    }
-
-    double Y = 0.299 * (double)R + 0.587 * (double)G + 0.114 * (double)B;
-    Y = gamma_correct(Y, 1);
+// Palette 320 artifact colours indexed by the half of the palette (index below or above 0x10) and phase rotated colour
+static const int ntsc_artifact_rgb_320[2][16][3] = {
+   {
+      {   0,   0,   0 },
+      {   0,  49, 111 },
+      { 123,  52,   0 },
+      { 131, 118,  73 },
+      { 235,  50,   7 },
+      { 248, 122, 155 },
+      { 180,  69,   0 },
+      { 190, 133,  80 },
+      {   0, 117, 108 },
+      {   0,  83,  63 },
+      {  57, 190,  66 },
+      {  83, 155,  14 },
+      { 210, 196, 153 },
+      { 217, 160, 107 },
+      { 139, 208,  74 },
+      { 152, 173,  20 }
+   }, {
+      {   0,   0,   0 },
+      {   0,  73, 174 },
+      {  89,  28,   0 },
+      {  99, 116, 158 },
+      { 237,  28,  39 },
+      { 221, 125, 239 },
+      { 255,  73,   0 },
+      { 255, 165, 196 },
+      {   0, 139, 172 },
+      {   0, 158, 232 },
+      {   0, 188, 155 },
+      {   0, 206, 217 },
+      { 180, 196, 238 },
+      { 188, 210, 255 },
+      { 247, 237, 193 },
+      { 255, 255, 255 }
+   }
+};
 
-    return R | (G << 8) | (B << 16) | ((int)Y << 24);
+int create_NTSC_artifact_colours_palette_320(int index) {
+    const int *RGB = ntsc_artifact_rgb_320[index >= 0x10][ntsc_artifact_rotate(index & 0x0f)];
+    int R = RGB[0];
+    int G = RGB[1];
+    int B = RGB[2];
+    // Y = 0.299 * R + 0.587 * G + 0.114 * B with 8 fractional bits, scaled by 255 as gamma_correct(Y, 1) did
+    int Y = ntsc_artifact_component((77 * R + 150 * G + 29 * B) * 255, 100);
+
+    return R | (G << 8) | (B << 16) | (Y << 24);
 }
 
 void yuv2rgb(int maxdesat, int mindesat, int luma_scale, int blank_ref, int y1_millivolts, int u1_millivolts, int v1_millivolts, int *r, int *g, int *b, int *m) {
@@ -4922,23 +4918,74 @@ int get_inhibit_palette_dimming16() {
     }
 }
 
-void osd_write_palette(int new_active) {
-    if (capinfo->bpp < 16) {
-        if (new_active != old_active) {
-            old_active = new_active;
+static void osd_stage_palette(int new_active) {
+    pending_active = new_active;
+    palette_pending = 1;
+}
+
+// Called from the capture loop when the Pi vsync interrupt is seen (and from
+// wait_for_pi_fieldsync) so the palette switch lands in the vertical blank.
+// The response is not waited for to avoid a blocking mailbox round trip.
+void osd_apply_pending_palette() {
+    if (palette_pending) {
+        palette_pending = 0;
+        if (capinfo->bpp < 16) {
             int num_colours = (capinfo->bpp == 8) ? 256 : 16;
             RPI_PropertyInit();
-            if (new_active != 0) {
+            if (pending_active != 0) {
                 RPI_PropertyAddTag(TAG_SET_PALETTE, num_colours, osd_palette_data);
             } else {
                 RPI_PropertyAddTag(TAG_SET_PALETTE, num_colours, palette_data);
             }
-            RPI_PropertyProcess();
+            RPI_PropertyProcessNoCheck();
+        }
+    }
+}
+
+void osd_write_palette(int new_active) {
+    if (capinfo->bpp < 16) {
+        if (new_active != old_active) {
+            old_active = new_active;
+            osd_stage_palette(new_active);
             //log_info("***Palette change %d", new_active);
         }
     }
 }
 
+static void update_palette_4096() {
+    // 12bpp captures bypass the palette so build a LUT from every captured value to a colour corrected
+    // ARGB4444 value for the twelvebits 16bpp capture kernels. Only enabled when an adjustment is active
+    // or when core 1 is available to apply the CRT mask.
+    int mask = get_core_1_available() ? get_feature(F_CRT_MASK) : CRTMASK_NONE;
+    // the 16bpp capture does its own scanlines at a flat level so the style only applies to the mask there
+    features[F_SCANLINE_STYLE].hidden = (capinfo->bpp == 16 && mask == CRTMASK_NONE);
+    if (capinfo->bpp == 16 && (mask != CRTMASK_NONE || get_parameter(F_TINT) != 0 || get_parameter(F_SAT) != 100 || get_parameter(F_CONT) != 100 || get_parameter(F_BRIGHT) != 100 || get_parameter(F_GAMMA) != 100)) {
+        for (int i = 0; i < 4096; i++) {
+            int index = i;
+            if (get_feature(F_OUTPUT_INVERT) == INVERT_RGB) {
+                index ^= 0xfff;
+            } else if (get_feature(F_OUTPUT_INVERT) == INVERT_Y) {
+                index ^= 0x0f0;
+            }
+            int r = ((index >> 8) & 0x0f) * 0x11;
+            int g = ((index >> 4) & 0x0f) * 0x11;
+            int b = (index & 0x0f) * 0x11;
+            int m = ((299 * r + 587 * g + 114 * b + 500) / 1000);
+            int colour = adjust_palette((m << 24) | (b << 16) | (g << 8) | r);
+            r = colour & 0xff;
+            g = (colour >> 8) & 0xff;
+            b = (colour >> 16) & 0xff;
+            palette_data_4096[i] = 0xf000 | ((r >> 4) << 8) | ((g >> 4) << 4) | (b >> 4);
+        }
+        // the mask is only used on single height lines where get_parameter() reports the scanline level as 0
+        scanline_build_mask(palette_data_4096, mask, get_feature(F_SCANLINE_STYLE), get_stored_parameter(F_SCANLINE_LEVEL));
+        palette_data_4096_enabled = 1;
+    } else {
+        scanline_build_mask(palette_data_4096, CRTMASK_NONE, 0, 0);
+        palette_data_4096_enabled = 0;
+    }
+}
+
 void osd_update_palette() {
     int r = 0;
     int g = 0;
@@ -4948,6 +4995,8 @@ void osd_update_palette() {
     int design_type = (cpld->get_version() >> VERSION_DESIGN_BIT) & 0x0F;
     int max_palette_count = palette_array[get_parameter(F_PALETTE)][MAX_PALETTE_ENTRIES - 1];
 
+    scanline_build_curve(get_feature(F_SCANLINE_STYLE), get_feature(F_SCANLINE_LEVEL));
+
     //copy selected palette to current palette, translating for Atom cpld and inverted Y setting (required for 6847 direct Y connection)
 
     for (int i = 0; i < num_colours; i++) {
@@ -5087,10 +5136,9 @@ void osd_update_palette() {
         }
 
         if ((i >= (num_colours >> 1)) && get_feature(F_SCANLINES) && max_palette_count <= 128) {
-            int scanline_intensity = get_feature(F_SCANLINE_LEVEL) ;
-            r = (r * scanline_intensity) / 15;
-            g = (g * scanline_intensity) / 15;
-            b = (b * scanline_intensity) / 15;
+            r = scanline_curve[r];
+            g = scanline_curve[g];
+            b = scanline_curve[b];
             palette_data[i] = 0xFF000000 | (b << 16) | (g << 8) | r;
         } else {
             palette_data[i] = 0xFF000000 | (b << 16) | (g << 8) | r;
@@ -5157,14 +5205,10 @@ void osd_update_palette() {
     }
 
 
+    update_palette_4096();
+
     if (capinfo->bpp < 16) {
-        RPI_PropertyInit();
-        if (active) {
-            RPI_PropertyAddTag(TAG_SET_PALETTE, num_colours, osd_palette_data);
-        } else {
-            RPI_PropertyAddTag(TAG_SET_PALETTE, num_colours, palette_data);
-        }
-        RPI_PropertyProcess();
+        osd_stage_palette(active);
         old_active = active;
     }
 }
@@ -5293,12 +5337,26 @@ int save_profile(char *path, char *name, char *buffer, char *default_buffer, cha
    }
 }
 
-void process_single_profile(char *buffer) {
+static void add_profile_setting(parsed_profile_t *parsed, int type, int set, int key, int value) {
+   if (parsed->num_settings < MAX_PROFILE_SETTINGS) {
+      profile_setting_t *setting = parsed->settings + parsed->num_settings++;
+      setting->type = type;
+      setting->set = set;
+      setting->key = key;
+      setting->value = value;
+   } else {
+      log_warn("Too many profile settings, ignoring the rest");
+   }
+}
+
+static void parse_profile(char *buffer, parsed_profile_t *parsed) {
    char param_string[80];
    char *prop;
-   int current_mode7 = geometry_get_mode();
    int i;
-   if (buffer[0] == 0) {
+   parsed->empty = (buffer[0] == 0);
+   parsed->has_options = 0;
+   parsed->num_settings = 0;
+   if (parsed->empty) {
       return;
    }
    int cpld_ver = (cpld->get_version() >> VERSION_DESIGN_BIT) & 0x0F;
@@ -5307,9 +5365,6 @@ void process_single_profile(char *buffer) {
        index = 0;
    }
    for (int set = 0; set <= MODE_SET2; set++) {
-      geometry_set_mode(set);
-      cpld->set_mode(set);
-
       prop = get_prop(buffer, set ? "sampling2" : "sampling");
       if (!prop) {
           prop = get_prop(buffer, "sampling"); //fall back if sampling2 missing
@@ -5326,7 +5381,7 @@ void process_single_profile(char *buffer) {
             }
             int val = atoi(prop2);
             log_debug("cpld: %s = %d", param->label, val);
-            cpld->set_value(param->key, val);
+            add_profile_setting(parsed, PROFILE_SET_CPLD, set, param->key, val);
             prop2 = strtok(NULL, ",");
             i++;
          }
@@ -5348,7 +5403,7 @@ void process_single_profile(char *buffer) {
             }
             int val = atoi(prop2);
             log_debug("geometry: %s = %d", param->label, val);
-            geometry_set_value(param->key, val);
+            add_profile_setting(parsed, PROFILE_SET_GEOMETRY, set, param->key, val);
             prop2 = strtok(NULL, ",");
             i++;
          }
@@ -5356,9 +5411,6 @@ void process_single_profile(char *buffer) {
 
    }
 
-   geometry_set_mode(current_mode7);
-   cpld->set_mode(current_mode7);
-
    i = 0;
    while(features[i].key >= 0) {
       if (i != F_RESOLUTION && i != F_REFRESH && i != F_SCALING && i != F_FRONTEND && i != F_PROFILE && i != F_SAVED_CONFIG && i != F_SUB_PROFILE && i!= F_BUTTON_REVERSE && i != F_HDMI_MODE && i != F_HDMI_AUTO && i != F_PROFILE_NUM && i != F_H_WIDTH && i != F_V_HEIGHT && i != F_H_OFFSET && i != F_V_OFFSET && i != F_CLOCK && i != F_LINE_LEN) {
@@ -5368,14 +5420,14 @@ void process_single_profile(char *buffer) {
             if (i == F_PALETTE) {
                 for (int j = 0; j <= features[F_PALETTE].max; j++) {
                     if (strcmp(palette_names[j], prop) == 0) {
-                        set_feature(i, j);
+                        add_profile_setting(parsed, PROFILE_SET_FEATURE, 0, i, j);
                         break;
                     }
                 }
                 log_debug("profile: %s = %s",param_string, prop);
             } else {
                 int val = atoi(prop);
-                set_feature(i, val);
+                add_profile_setting(parsed, PROFILE_SET_FEATURE, 0, i, val);
                 log_debug("profile: %s = %d",param_string, val);
             }
          }
@@ -5383,8 +5435,11 @@ void process_single_profile(char *buffer) {
       i++;
    }
 
+   parsed->has_options = get_prop(buffer, "keymap") || get_prop(buffer, "actionmap") || get_prop(buffer, "single_button_mode") || get_prop(buffer, "cpld_firmware_dir");
+}
 
-   // Properties below this point are not updateable in the UI
+static void process_profile_options(char *buffer) {
+   char *prop;
    prop = get_prop(buffer, "keymap");
    if (prop) {
       int i = 0;
@@ -5450,6 +5505,46 @@ void process_single_profile(char *buffer) {
            strcpy(cpld_firmware_dir, prop);
       }
    }
+}
+
+static void apply_parsed_profile(parsed_profile_t *parsed, char *buffer) {
+   if (parsed->empty) {
+      return;
+   }
+   int current_mode7 = geometry_get_mode();
+   int current_set = -1;
+   for (int i = 0; i < parsed->num_settings; i++) {
+      profile_setting_t *setting = parsed->settings + i;
+      if (setting->type == PROFILE_SET_FEATURE) {
+         if (current_set >= 0) {
+            current_set = -1;
+            geometry_set_mode(current_mode7);
+            cpld->set_mode(current_mode7);
+         }
+         set_feature(setting->key, setting->value);
+      } else {
+         if (setting->set != current_set) {
+            current_set = setting->set;
+            geometry_set_mode(current_set);
+            cpld->set_mode(current_set);
+         }
+         if (setting->type == PROFILE_SET_CPLD) {
+            cpld->set_value(setting->key, setting->value);
+         } else {
+            geometry_set_value(setting->key, setting->value);
+         }
+      }
+   }
+   if (current_set >= 0) {
+      geometry_set_mode(current_mode7);
+      cpld->set_mode(current_mode7);
+   }
+
+   // Properties below this point are not updateable in the UI
+   if (parsed->has_options) {
+      process_profile_options(buffer);
+   }
+
    // Disable CPLDv2 specific features for CPLDv1
    if (cpld->old_firmware_support() & BIT_NORMAL_FIRMWARE_V1) {
       features[F_MODE7_DEINTERLACE].max = M7DEINTERLACE_MA4;
@@ -5458,12 +5553,23 @@ void process_single_profile(char *buffer) {
       }
    }
 #ifdef USE_ARM_CAPTURE
+   // Without core 1 there isn't time to deinterlace during the capture, with core 1 Bob and the MA modes run there
+   // instead so only those are offered (ADV still needs the capture to do it)
    if (_get_hardware_id() == _RPI2 || _get_hardware_id() == _RPI3) {
-      set_feature(F_MODE7_DEINTERLACE, M7DEINTERLACE_NONE);
+      features[F_MODE7_DEINTERLACE].max = get_core_1_available() ? M7DEINTERLACE_MA4 : M7DEINTERLACE_NONE;
+      if (get_feature(F_MODE7_DEINTERLACE) > features[F_MODE7_DEINTERLACE].max) {
+         set_feature(F_MODE7_DEINTERLACE, M7DEINTERLACE_NONE);
+      }
    }
 #endif
 }
 
+void process_single_profile(char *buffer) {
+   static parsed_profile_t parsed;
+   parse_profile(buffer, &parsed);
+   apply_parsed_profile(&parsed, buffer);
+}
+
 void get_autoswitch_geometry(char *buffer, int index)
 {
    char *prop;
@@ -5530,20 +5636,47 @@ void process_profile(int profile_number) {
 void process_sub_profile(int profile_number, int sub_profile_number) {
    if (has_sub_profiles[profile_number]) {
       int saved_autoswitch = get_feature(F_AUTO_SWITCH);                   // save autoswitch so it can be disabled to manually switch sub profiles
-      process_single_profile(default_buffer);
-      process_single_profile(sub_default_buffer);
+      apply_parsed_profile(&parsed_default, default_buffer);
+      apply_parsed_profile(&parsed_sub_default, sub_default_buffer);
       set_feature(F_AUTO_SWITCH, saved_autoswitch);
-      process_single_profile(sub_profile_buffers[sub_profile_number]);
+      apply_parsed_profile(&parsed_sub_profiles[sub_profile_number], sub_profile_buffers[sub_profile_number]);
       cycle_menus();
    }
 }
 
+static void build_autoswitch_index(int count) {
+   // insertion sort on (sync_type, lower_limit), there are at most MAX_SUB_PROFILES entries
+   for (int i = 0; i < count; i++) {
+      int j = i;
+      while (j > 0) {
+         autoswitch_info_t *prev = &autoswitch_info[autoswitch_index[j - 1]];
+         if (prev->sync_type < autoswitch_info[i].sync_type
+             || (prev->sync_type == autoswitch_info[i].sync_type && prev->lower_limit <= autoswitch_info[i].lower_limit)) {
+            break;
+         }
+         autoswitch_index[j] = autoswitch_index[j - 1];
+         j--;
+      }
+      autoswitch_index[j] = i;
+   }
+   for (int j = 0; j < count; j++) {
+      int upper = autoswitch_info[autoswitch_index[j]].upper_limit;
+      if (j > 0 && autoswitch_info[autoswitch_index[j - 1]].sync_type == autoswitch_info[autoswitch_index[j]].sync_type && autoswitch_max_upper[j - 1] > upper) {
+         upper = autoswitch_max_upper[j - 1];
+      }
+      autoswitch_max_upper[j] = upper;
+   }
+   autoswitch_index_count = count;
+}
+
 void load_profiles(int profile_number, int save_selected) {
    unsigned int bytes ;
    main_buffer[0] = 0;
    features[F_SUB_PROFILE].max = 0;
    strcpy(sub_profile_names[0], NOT_FOUND_STRING);
    sub_profile_buffers[0][0] = 0;
+   parse_profile(sub_profile_buffers[0], &parsed_sub_profiles[0]);   // don't leave the previous profile's settings behind if no sub profiles are found
+   autoswitch_index_count = 0;
    if (has_sub_profiles[profile_number]) {
       bytes = file_read_profile(profile_names[profile_number] + cpld_prefix_length, get_parameter(F_SAVED_CONFIG), DEFAULT_STRING, save_selected, sub_default_buffer, MAX_BUFFER_SIZE - 4);
       if (!bytes) {
@@ -5558,8 +5691,12 @@ void load_profiles(int profile_number, int save_selected) {
          for (int i = 0; i < count; i++) {
             file_read_profile(profile_names[profile_number] + cpld_prefix_length, get_parameter(F_SAVED_CONFIG), sub_profile_names[i], 0, sub_profile_buffers[i], MAX_BUFFER_SIZE - 4);
             get_autoswitch_geometry(sub_profile_buffers[i], i);
+            parse_profile(sub_profile_buffers[i], &parsed_sub_profiles[i]);
          }
+         build_autoswitch_index(count);
       }
+      parse_profile(default_buffer, &parsed_default);
+      parse_profile(sub_default_buffer, &parsed_sub_default);
    } else {
       features[F_SUB_PROFILE].max = 0;
       strcpy(sub_profile_names[0], NONE_STRING);
@@ -5577,19 +5714,39 @@ int sub_profiles_available(int profile_number) {
 int autoswitch_detect(int one_line_time_ns, int lines_per_vsync, int sync_type) {
    if (has_sub_profiles[get_feature(F_PROFILE)]) {
       log_info("Looking for autoswitch match = %d, %d, %d", one_line_time_ns, lines_per_vsync, sync_type);
-      for (int i=0; i <= features[F_SUB_PROFILE].max; i++) {
-         //log_info("Autoswitch test: %s (%d) = %d, %d, %d, %d", sub_profile_names[i], i, autoswitch_info[i].lower_limit,
-         //          autoswitch_info[i].upper_limit, autoswitch_info[i].lines_per_frame, autoswitch_info[i].sync_type );
+      // find the first entry past those with this sync type and lower_limit < one_line_time_ns
+      int lo = 0;
+      int hi = autoswitch_index_count;
+      while (lo < hi) {
+         int mid = (lo + hi) >> 1;
+         autoswitch_info_t *info = &autoswitch_info[autoswitch_index[mid]];
+         if (info->sync_type < sync_type || (info->sync_type == sync_type && info->lower_limit < one_line_time_ns)) {
+            lo = mid + 1;
+         } else {
+            hi = mid;
+         }
+      }
+      // walk back through the candidates until none can reach one_line_time_ns, keeping the
+      // lowest numbered match so the result is the same as testing the sub-profiles in order
+      int match = -1;
+      for (int j = lo - 1; j >= 0; j--) {
+         int i = autoswitch_index[j];
+         if (autoswitch_info[i].sync_type != sync_type || autoswitch_max_upper[j] <= one_line_time_ns) {
+            break;
+         }
          if (   one_line_time_ns > autoswitch_info[i].lower_limit
                 && one_line_time_ns < autoswitch_info[i].upper_limit
                 && lines_per_vsync >= autoswitch_info[i].lower_frame_limit
                 && lines_per_vsync <= autoswitch_info[i].upper_frame_limit
-                && sync_type == autoswitch_info[i].sync_type ) {
-            log_info("Autoswitch match: %s (%d) = %d, %d, %d, %d, %d", sub_profile_names[i], i, autoswitch_info[i].lower_limit,
-                     autoswitch_info[i].upper_limit, autoswitch_info[i].lower_frame_limit, autoswitch_info[i].upper_frame_limit, autoswitch_info[i].sync_type );
-            return (i);
+                && (match < 0 || i < match)) {
+            match = i;
          }
       }
+      if (match >= 0) {
+         log_info("Autoswitch match: %s (%d) = %d, %d, %d, %d, %d", sub_profile_names[match], match, autoswitch_info[match].lower_limit,
+                  autoswitch_info[match].upper_limit, autoswitch_info[match].lower_frame_limit, autoswitch_info[match].upper_frame_limit, autoswitch_info[match].sync_type );
+      }
+      return match;
    }
    return -1;
 }
@@ -6243,6 +6400,7 @@ int osd_key(int key) {
                         write_profile_choice((char*)item_name(item) + cpld_prefix_length, 0, (char*)cpld->nameYUV);
                     }
                     int count;
+                    int result = -1;
                     char cpld_dir[MAX_STRING_SIZE];
                     strncpy(cpld_dir, cpld_firmware_dir, MAX_STRING_LIMIT);
                     scan_cpld_filenames(cpld_filenames, cpld_dir, &count);
@@ -6252,13 +6410,18 @@ int osd_key(int key) {
                     for(int i = 0; i < count; i++) {
                         if(strstr(cpld_filenames[i], cpld_type) != 0) {
                             sprintf(filename, "%s/%s.xsvf", cpld_firmware_dir, cpld_filenames[i]);
-                            // Reprograme the CPLD
-                            update_cpld(filename, 1);
+                            // Reprograme the CPLD (only returns on failure or if it is already up to date)
+                            result = update_cpld(filename, 1);
                             break;
                         }
                     }
-                    log_info("CPLD update failed");
-                    sprintf(msg, "CPLD update failed");
+                    if (result == 0) {
+                        log_info("CPLD already up to date");
+                        sprintf(msg, "CPLD already up to date");
+                    } else {
+                        log_info("CPLD update failed");
+                        sprintf(msg, "CPLD update failed");
+                    }
                 }
             } else {
                 depth = 0;
@@ -7552,7 +7715,7 @@ void osd_update(uint32_t *osd_base, int bytes_per_line, int relocate) {
 #endif
 //************** should be capinfo->detected_sync_type below?
    if (capinfo->bpp == 16) {
-       if (capinfo->video_type == VIDEO_INTERLACED && (capinfo->sync_type & SYNC_BIT_INTERLACED) && get_parameter(F_NORMAL_DEINTERLACE) == DEINTERLACE_NONE) {
+       if (capinfo->video_type == VIDEO_INTERLACED && (capinfo->sync_type & SYNC_BIT_INTERLACED) && get_parameter(F_NORMAL_DEINTERLACE) != DEINTERLACE_BOB) {
            clear_full_screen();
        }
    }
@@ -7785,7 +7948,7 @@ void __attribute__ ((aligned (64))) osd_update_fast(uint32_t *osd_base, int byte
    if (!active) {
       return;
    }
-   if (capinfo->bpp == 16 && capinfo->video_type == VIDEO_INTERLACED && (capinfo->detected_sync_type & SYNC_BIT_INTERLACED) && get_parameter(F_NORMAL_DEINTERLACE) == DEINTERLACE_NONE) {
+   if (capinfo->bpp == 16 && capinfo->video_type == VIDEO_INTERLACED && (capinfo->detected_sync_type & SYNC_BIT_INTERLACED) && get_parameter(F_NORMAL_DEINTERLACE) != DEINTERLACE_BOB) {
       clear_screen();
    }
 
@@ -15,6 +15,8 @@ extern int customPalette[];
 extern char paletteHighNibble[];
 extern int paletteFlags;
 extern int palette_data_16[];
+extern unsigned short palette_data_4096[];
+extern int palette_data_4096_enabled;
 extern int c64_artifact_palette_16[];
 extern char c64_YUV_palette_lookup[];
 
@@ -106,6 +108,19 @@ enum {
    NUM_COLOURS
 };
 
+enum {
+   SCANLINE_FLAT,
+   SCANLINE_WEIGHTED,
+   SCANLINE_LINEAR_LIGHT,
+   NUM_SCANLINE_STYLES
+};
+
+enum {
+   CRTMASK_NONE,
+   CRTMASK_APERTURE,
+   NUM_CRTMASKS
+};
+
 enum {
    INVERT_NORMAL,
    INVERT_RGB,
@@ -122,6 +137,8 @@ enum {
    SCALING_FILL43_VERY_SOFT,
    SCALING_FILLALL_SOFT,
    SCALING_FILLALL_VERY_SOFT,
+   SCALING_FILL43_SHARP,
+   SCALING_FILLALL_SHARP,
    NUM_SCALING
 };
 
@@ -139,6 +156,7 @@ enum {
 enum {
    DEINTERLACE_NONE,
    DEINTERLACE_BOB,
+   DEINTERLACE_MA,
    NUM_DEINTERLACES
 };
 
@@ -275,6 +293,8 @@ enum {
    F_OUTPUT_INVERT,
    F_SCANLINES,
    F_SCANLINE_LEVEL,
+   F_SCANLINE_STYLE,
+   F_CRT_MASK,
    F_CROP_BORDER,
    F_SCREENCAP_SIZE,
    F_FONT_SIZE,
@@ -315,6 +335,7 @@ enum {
 void osd_init();
 void osd_clear();
 void osd_write_palette(int new_active);
+void osd_apply_pending_palette();
 void osd_set(int line, int attr, char *text);
 void osd_set_noupdate(int line, int attr, char *text);
 void osd_set_clear(int line, int attr, char *text);
@@ -55,8 +55,11 @@ extern int capture_line_simple_9bpphi_table();
 extern int capture_line_simple_12bpp_table();
 
 extern int vsync_line;
+extern unsigned int last_vsync_time;
+extern volatile unsigned int pi_vsync_time;
 extern int total_lines;
 extern int lock_fail;
+extern volatile int capture_line_count;
 
 extern int elk_mode;
 
@@ -16,6 +16,7 @@
 #include "startup.h"
 #include "rpi-mailbox.h"
 #include "osd.h"
+#include "deinterlace.h"
 #include "cpld.h"
 #include "cpld_atom.h"
 #include "cpld_rgb.h"
@@ -179,8 +180,6 @@ static int clear;
 static volatile int delay;
 static double pllh_clock = 0;
 static int genlocked = 0;
-static int resync_count = 0;
-static int target_difference = 0;
 static int half_frame_rate = 0;
 static int source_vsync_freq_hz = 0;
 static int info_display_vsync_freq_hz = 0;
@@ -229,6 +228,25 @@ static int config_overscan_top = 0;
 static int config_overscan_bottom = 0;
 static int startup_overscan = 0;
 static int cpuspeed = 1000;
+static int vsync_phase_ns = 0;
+static int vsync_phase_valid = 0;
+static int beam_race_gap = -1;
+#ifdef MULTI_BUFFER
+// Buffers used while beam racing (0 = single, 1 = double), picked up by rgb_to_fb every field, -1 when not beam racing
+int beam_race_nbuffers = -1;
+// Frame pacing state, used when genlock can't reach the source rate
+static int frame_pacing = 0;
+static int pacing_running = 0;
+static unsigned int pacing_completed = 0;
+static unsigned int pacing_displayed = 0;
+static int pacing_buffer[NBUFFERS];
+static int pacing_phase = 0;
+static int pacing_src_millihz = 0;
+static int pacing_out_millihz = 0;
+static int pacing_vsyncs = 0;
+static int pacing_judder = 0;
+static int pacing_judder_last = -1;
+#endif
 static int cpld_fail_state = CPLD_NORMAL;
 static int helper_flag = 0;
 static int simple_detected = 0;
@@ -389,38 +407,20 @@ static void init_gpclk(int source, int divisor) {
 static void init_framebuffer(capture_info_t *capinfo) {
 static int last_width = -1;
 static int last_height = -1;
+// geometry of the currently allocated frame buffer, used to skip reallocation when nothing has changed
+static int alloc_width = -1;
+static int alloc_height = -1;
+static int alloc_bpp = -1;
+static int alloc_pitch = 0;
+static int alloc_overscan[4];
+static int alloc_hdisplay = -1;
+static int alloc_vdisplay = -1;
 int width = 0;
 int height = 0;
 
 
     rpi_mailbox_property_t *mp;
 
-    if (capinfo->width != last_width || capinfo->height != last_height) {
-       //if (last_width != -1 && last_height != -1) {
-       //   clear_full_screen();
-       //}
-       // Fill in the frame buffer structure with a small dummy frame buffer first
-       /* Initialise a framebuffer... */
-       RPI_PropertyInit();
-       RPI_PropertyAddTag(TAG_ALLOCATE_BUFFER, 0x02000000);
-       RPI_PropertyAddTag(TAG_SET_PHYSICAL_SIZE, 64, 64);
-    #ifdef MULTI_BUFFER
-       RPI_PropertyAddTag(TAG_SET_VIRTUAL_SIZE, 64, 64);
-    #else
-       RPI_PropertyAddTag(TAG_SET_VIRTUAL_SIZE, 64, 64);
-    #endif
-       RPI_PropertyAddTag(TAG_SET_DEPTH, capinfo->bpp);
-
-       RPI_PropertyProcess();
-
-
-        // FIXME: A small delay (like the log) is neccessary here
-        // or the RPI_PropertyGet seems to return garbage
-        log_info("Width or Height differ from last FB: Setting dummy 64x64 framebuffer");
-
-    }
-
-
     //last_width = capinfo->width;
     //last_height = capinfo->height;
     /* work out if overscan needed */
@@ -472,6 +472,46 @@ int height = 0;
     bottom_overscan += config_overscan_bottom;
 
     log_info("Overscan L=%d, R=%d, T=%d, B=%d",left_overscan, right_overscan, top_overscan, bottom_overscan);
+
+    // Fast path: if the GPU already has a frame buffer of exactly this geometry then reallocating it
+    // only causes a blank and HDMI resync, so keep the existing buffer, pitch and display list
+    if (capinfo->width == alloc_width && capinfo->height == alloc_height && capinfo->bpp == alloc_bpp
+        && get_hdisplay() == alloc_hdisplay && get_vdisplay() == alloc_vdisplay
+        && top_overscan == alloc_overscan[0] && bottom_overscan == alloc_overscan[1]
+        && left_overscan == alloc_overscan[2] && right_overscan == alloc_overscan[3]) {
+        capinfo->pitch = alloc_pitch;
+        capinfo->fb = (unsigned char *)(framebuffer & 0x3fffffff);
+        osd_update_palette();
+        osd_apply_pending_palette();
+        log_info("Reusing framebuffer: %dx%d bpp=%d", capinfo->width, capinfo->height, capinfo->bpp);
+        return;
+    }
+
+    if (capinfo->width != last_width || capinfo->height != last_height) {
+       //if (last_width != -1 && last_height != -1) {
+       //   clear_full_screen();
+       //}
+       // Fill in the frame buffer structure with a small dummy frame buffer first
+       /* Initialise a framebuffer... */
+       RPI_PropertyInit();
+       RPI_PropertyAddTag(TAG_ALLOCATE_BUFFER, 0x02000000);
+       RPI_PropertyAddTag(TAG_SET_PHYSICAL_SIZE, 64, 64);
+    #ifdef MULTI_BUFFER
+       RPI_PropertyAddTag(TAG_SET_VIRTUAL_SIZE, 64, 64);
+    #else
+       RPI_PropertyAddTag(TAG_SET_VIRTUAL_SIZE, 64, 64);
+    #endif
+       RPI_PropertyAddTag(TAG_SET_DEPTH, capinfo->bpp);
+
+       RPI_PropertyProcess();
+
+
+        // FIXME: A small delay (like the log) is neccessary here
+        // or the RPI_PropertyGet seems to return garbage
+        log_info("Width or Height differ from last FB: Setting dummy 64x64 framebuffer");
+
+    }
+
     /* Initialise a framebuffer... */
     RPI_PropertyInit();
     RPI_PropertyAddTag(TAG_ALLOCATE_BUFFER, 0x02000000);
@@ -515,8 +555,20 @@ int height = 0;
       capinfo->fb = (unsigned char *)(framebuffer & 0x3fffffff);
     }
 
+    alloc_width = capinfo->width;
+    alloc_height = capinfo->height;
+    alloc_bpp = capinfo->bpp;
+    alloc_pitch = capinfo->pitch;
+    alloc_hdisplay = get_hdisplay();
+    alloc_vdisplay = get_vdisplay();
+    alloc_overscan[0] = top_overscan;
+    alloc_overscan[1] = bottom_overscan;
+    alloc_overscan[2] = left_overscan;
+    alloc_overscan[3] = right_overscan;
+
     //Initialize the palette
     osd_update_palette();
+    osd_apply_pending_palette();
 
 /*
         volatile uint32_t  d;
@@ -676,6 +728,7 @@ static void init_framebuffer(capture_info_t *capinfo) {
 
    // Initialize the palette
    osd_update_palette();
+   osd_apply_pending_palette();
 }
 
 #endif
@@ -1088,7 +1141,7 @@ int calibrate_sampling_clock(int profile_changed) {
    return a;
 }
 
-static void recalculate_hdmi_clock(int genlock_mode, int genlock_adjust) {
+static void recalculate_hdmi_clock(int genlock_mode, int genlock_adjust_ppm) {
    static double last_f2 = 0.0f;
    static double error = 1.0f;
 
@@ -1200,7 +1253,7 @@ static void recalculate_hdmi_clock(int genlock_mode, int genlock_adjust) {
 
    if (genlock_mode != HDMI_ORIGINAL && source_vsync_freq >= 48) {
       f2 /= error;
-      f2 /= 1.0 + ((double) (genlock_adjust * GENLOCK_PPM_STEP) / 1000000);
+      f2 /= 1.0 + ((double) genlock_adjust_ppm / 1000000);
    }
 
    // Sanity check HDMI pixel clock
@@ -1275,17 +1328,18 @@ static void recalculate_hdmi_clock(int genlock_mode, int genlock_adjust) {
           double current_pllh_clock = (CRYSTAL * ((double)(gpioreg[PLLH_CTRL] & 0x3ff) + ((double)gpioreg[PLLH_FRAC]) / ((double)(1 << 20)))) * PLLH_ANA1_PREDIV;
 #endif
           int ppm_diff = (int)((1 - (current_pllh_clock / f2)) * 1000000);
+          // the clock is trimmed every frame so limit each step to a share of the slew allowed per adjustment interval
           int genlock_speed;
           switch(parameters[F_GENLOCK_SPEED]) {
               case GENLOCK_SPEED_SLOW:
-                  genlock_speed = 333;
+                  genlock_speed = 333 / (GENLOCK_SLEW_FRAMES * 2);
               break;
               case GENLOCK_SPEED_MEDIUM:
-                  genlock_speed = 1000;
+                  genlock_speed = 1000 / (GENLOCK_SLEW_FRAMES * 2);
               break;
               default:
               case GENLOCK_SPEED_FAST:
-                  genlock_speed = 2000;
+                  genlock_speed = 2000 / GENLOCK_SLEW_FRAMES;
               break;
           }
           //log_info("%d", ppm_diff);
@@ -1316,10 +1370,13 @@ static void recalculate_hdmi_clock(int genlock_mode, int genlock_adjust) {
 }
 
 int __attribute__ ((aligned (64))) recalculate_hdmi_clock_line_locked_update(int force) {
-    static int framecount = 0;
     static int genlock_adjust = 0;
+    static int genlock_integral = 0;
+    static int lock_count = 0;
     static int last_vlock = -1;
-    static int thresholds[GENLOCK_MAX_STEPS] = GENLOCK_THRESHOLDS;
+    static const int genlock_kp[NUM_GENLOCK_SPEED] = GENLOCK_PI_KP;
+    static const int genlock_ki[NUM_GENLOCK_SPEED] = GENLOCK_PI_KI;
+    static const int genlock_max_ppm[NUM_GENLOCK_SPEED] = GENLOCK_PI_MAX_PPM;
 
     static double line_total = 0;
     static int line_count = 0;
@@ -1445,140 +1502,156 @@ int __attribute__ ((aligned (64))) recalculate_hdmi_clock_line_locked_update(int
         frame_total = 0;
         last_vlock = 0x80000000;
         genlocked = 0;
+        beam_race_gap = -1;
+        vsync_phase_valid = 0;
         return 0;
     }
 
   //  lock_fail = 0;
-    if (sync_detected && last_sync_detected && last_but_one_sync_detected) {
+    if (sync_detected && last_sync_detected && last_but_one_sync_detected && vsync_period > 0 && hsync_period > 0) {
+        // Phase in cycles from the start of the source field to the latest Pi vsync as timestamped by the FIQ.
+        // That vsync may have come before this field's source vsync, so the phase is taken modulo the field.
+        int vsync_phase = (int) (pi_vsync_time - last_vsync_time) % vsync_period;
+        if (vsync_phase < 0) {
+            vsync_phase += vsync_period;
+        }
+        // Smooth it for display, the phase wraps every field so the error is taken the short way round before filtering.
+        int phase_ns = (int) ((double) vsync_phase * 1000 / cpuspeed);
+        int period_ns = (int) ((double) vsync_period * 1000 / cpuspeed);
+        if (!vsync_phase_valid) {
+            vsync_phase_ns = phase_ns;
+            vsync_phase_valid = 1;
+        } else {
+            int delta = phase_ns - vsync_phase_ns;
+            if (delta > (period_ns >> 1)) {
+                delta -= period_ns;
+            } else if (delta < -(period_ns >> 1)) {
+                delta += period_ns;
+            }
+            vsync_phase_ns += delta >> VSYNC_PHASE_FILTER;
+            if (vsync_phase_ns < 0) {
+                vsync_phase_ns += period_ns;
+            } else if (vsync_phase_ns >= period_ns) {
+                vsync_phase_ns -= period_ns;
+            }
+        }
         int adjustment = 0;
         if (capinfo->nlines >= GENLOCK_NLINES_THRESHOLD) {
             adjustment = 1;
         }
         if (parameters[F_GENLOCK_MODE] != HDMI_EXACT || vlock_limited != 0) {
             genlocked = 0;
-            target_difference = 0;
-            resync_count = 0;
+            beam_race_gap = -1;
             genlock_adjust = 0;
             switch (parameters[F_GENLOCK_MODE]) {
                 case HDMI_SLOW_2000PPM:
-                    genlock_adjust = 6;
+                    genlock_adjust = 2000;
                     break;
                 case HDMI_SLOW_1000PPM:
-                    genlock_adjust = 3;
+                    genlock_adjust = 1000;
                     break;
                 case HDMI_FAST_1000PPM:
-                    genlock_adjust = -3;
+                    genlock_adjust = -1000;
                     break;
                 case HDMI_FAST_2000PPM:
-                    genlock_adjust = -6;
+                    genlock_adjust = -2000;
                     break;
             }
             if (last_vlock != parameters[F_GENLOCK_MODE] || vlock_limited != 0) {
                 recalculate_hdmi_clock(parameters[F_GENLOCK_MODE], genlock_adjust);
                 last_vlock = parameters[F_GENLOCK_MODE];
-                framecount = 0;
             }
         } else {
-            int max_steps = GENLOCK_MAX_STEPS;
-            int locked_threshold = GENLOCK_LOCKED_THRESHOLD;
-            int frame_delay = GENLOCK_FRAME_DELAY;
-            if (parameters[F_GENLOCK_SPEED] == GENLOCK_SPEED_MEDIUM) {
-                max_steps >>= 1;
-                locked_threshold--;
-                frame_delay <<= 1;
-            } else {
-                if (parameters[F_GENLOCK_SPEED] == GENLOCK_SPEED_SLOW) {
-                    max_steps = 1;
-                    locked_threshold = 1;
-                    frame_delay <<= 1;
-                }
+            // PI controller on the phase error between the Pi vsync and the target line, driving a
+            // continuous PLLH trim. Loop bandwidth and trim range come from the genlock speed setting.
+            // The Pi vsync position comes from its timestamp so the error resolves to a fraction of a line;
+            // like vsync_line it counts down from total_lines at the source vsync. The error is held in
+            // 1/(1 << GENLOCK_PI_FRAC_BITS) lines and the integral in 1/(1 << (2 * GENLOCK_PI_FRAC_BITS)) ppm.
+            int speed = parameters[F_GENLOCK_SPEED];
+            int max_ppm = genlock_max_ppm[speed];
+            int max_integral = max_ppm << (2 * GENLOCK_PI_FRAC_BITS);
+            int phase_lines = (int) ((double) vsync_phase * (1 << GENLOCK_PI_FRAC_BITS) / hsync_period);
+            int field_lines = (int) ((double) vsync_period * (1 << GENLOCK_PI_FRAC_BITS) / hsync_period) >> adjustment;
+            int pi_vsync_line = (total_lines << GENLOCK_PI_FRAC_BITS) - phase_lines;
+            signed int difference;
+#ifdef MULTI_BUFFER
+            int beam_race = parameters[F_NUM_BUFFERS] == BEAM_RACE_BUFFERS;
+            if (beam_race) {
+                // Place the Pi vsync a few lines into the active capture so the scanout follows the capture
+                difference = (pi_vsync_line >> adjustment) - (((capinfo->nlines - BEAM_RACE_GAP) >> adjustment) << GENLOCK_PI_FRAC_BITS);
+            } else
+#endif
+            {
+                difference = (pi_vsync_line >> adjustment) - (((total_lines >> adjustment) - parameters[F_GENLOCK_LINE]) << GENLOCK_PI_FRAC_BITS);
             }
-            signed int difference = (vsync_line >> adjustment) - ((total_lines >> adjustment) - parameters[F_GENLOCK_LINE]);
-            if (abs(difference) > (total_lines >> (adjustment + 1))) {
-                difference = -difference;
+            // The target is reached either way round the field so take the shorter
+            if (difference > (field_lines >> 1)) {
+                difference -= field_lines;
+            } else if (difference < -(field_lines >> 1)) {
+                difference += field_lines;
             }
-            if (genlocked == 1 && abs(difference) >= thresholds[locked_threshold]) {
-                genlocked = 0;
-                if (difference >= 0) {
-                    target_difference = -2;
-                } else {
-                    target_difference = 2;
-                }
-                if (abs(difference) > thresholds[locked_threshold]) {
-                    log_info("UnLock");
-                    resync_count = 0;
-                    target_difference = 0;
-               //     lock_fail = 1;
-                } else {
-                    log_info("Sync%02d", ++resync_count);
-                    if (resync_count >= 99) {
-                        resync_count = 0;
-                    }
-                }
+            if (last_vlock != HDMI_EXACT) {
+                genlock_integral = 0;
+                lock_count = 0;
             }
-            if(framecount == 0) {
-                int new_genlock_adjust = genlock_adjust;
-                if (genlocked == 0) {
-                    if (difference - target_difference == 0) {
-                        if (genlock_adjust < 0) {
-                            new_genlock_adjust++;
-                        }
-                        if (genlock_adjust > 0) {
-                            new_genlock_adjust--;
-                        }
-                        if (new_genlock_adjust == 0)
-                        {
-                            genlocked = 1;
-                            target_difference = 0;
-                            log_info("Locked");
-                            if (ppm_range_count <= PLL_RESYNC_THRESHOLD_LO && ppm_range > PLL_PPM_LO) {
-                                ppm_range--;
-                            } else {
-                                if (ppm_range_count >= PLL_RESYNC_THRESHOLD_HI && ppm_range < PLL_PPM_LO_LIMIT) {
-                                    ppm_range++;
-                                }
-                            }
-                            ppm_range_count = 0;
-                        }
+            genlock_integral += difference * genlock_ki[speed];
+            if (genlock_integral > max_integral) {
+                genlock_integral = max_integral;
+            } else if (genlock_integral < -max_integral) {
+                genlock_integral = -max_integral;
+            }
+            int new_genlock_adjust = ((difference * genlock_kp[speed]) >> GENLOCK_PI_FRAC_BITS) + (genlock_integral >> (2 * GENLOCK_PI_FRAC_BITS));
+            if (new_genlock_adjust > max_ppm) {
+                new_genlock_adjust = max_ppm;
+            } else if (new_genlock_adjust < -max_ppm) {
+                new_genlock_adjust = -max_ppm;
+            }
+
+            if (abs(difference) <= (GENLOCK_LOCK_WINDOW << GENLOCK_PI_FRAC_BITS)) {
+                if (genlocked == 0 && ++lock_count >= GENLOCK_LOCK_FRAMES) {
+                    genlocked = 1;
+                    log_info("Locked");
+                    if (ppm_range_count <= PLL_RESYNC_THRESHOLD_LO && ppm_range > PLL_PPM_LO) {
+                        ppm_range--;
                     } else {
-                        if (difference >= target_difference) {
-                            int threshold = 0;
-                            if (genlock_adjust >= 0 && genlock_adjust < max_steps) {
-                                threshold = thresholds[genlock_adjust];
-                            }
-                            if (genlock_adjust < max_steps && difference > threshold) {
-                                new_genlock_adjust++;
-                            }
-                            if (genlock_adjust > 1 && difference <= thresholds[genlock_adjust - 1]) {
-                                new_genlock_adjust--;
-                            }
-                        } else {
-                            int threshold = 0;
-                            if (genlock_adjust <= 0 && genlock_adjust > -max_steps) {
-                                threshold = -thresholds[-genlock_adjust];
-                            }
-                            if (genlock_adjust > -max_steps && difference < threshold) {
-                                new_genlock_adjust--;
-                            }
-                            if (genlock_adjust < -1 && difference >= -thresholds[-(genlock_adjust + 1)]) {
-                                new_genlock_adjust++;
-                            }
+                        if (ppm_range_count >= PLL_RESYNC_THRESHOLD_HI && ppm_range < PLL_PPM_LO_LIMIT) {
+                            ppm_range++;
                         }
                     }
-                    if (new_genlock_adjust != genlock_adjust || last_vlock != HDMI_EXACT || restricted_slew_rate) {
-                        recalculate_hdmi_clock(HDMI_EXACT, new_genlock_adjust);
-                        last_vlock = HDMI_EXACT;
-                        genlock_adjust = new_genlock_adjust;
-                        framecount = frame_delay;
-                        //log_debug("%4d,%4d,%4d,%4d,%4d,%4d", genlocked, parameters[F_GENLOCK_LINE], vsync_line, difference, thresholds[abs(genlock_adjust)], genlock_adjust);
-                    }
+                    ppm_range_count = 0;
                 }
+            } else {
+                lock_count = 0;
+                if (genlocked == 1 && abs(difference) > (GENLOCK_UNLOCK_WINDOW << GENLOCK_PI_FRAC_BITS)) {
+                    genlocked = 0;
+                    log_info("UnLock");
+                }
+            }
+
+#ifdef MULTI_BUFFER
+            // Tear detection: single buffering is only safe while locked with the scanout behind the capture
+            int gap = -1;
+            int vsync_line_now = pi_vsync_line >> GENLOCK_PI_FRAC_BITS;
+            if (beam_race && genlocked && (capinfo->nlines - vsync_line_now) >= BEAM_RACE_MIN_GAP) {
+                gap = capinfo->nlines - vsync_line_now;
+            }
+            if ((gap < 0) != (beam_race_gap < 0) && beam_race) {
+                log_info(gap < 0 ? "BeamOff" : "BeamOn");
+            }
+            beam_race_gap = gap;
+            if (beam_race_nbuffers >= 0) {
+                beam_race_nbuffers = (gap < 0) ? 1 : 0;
+            }
+#endif
+
+            if (new_genlock_adjust != genlock_adjust || last_vlock != HDMI_EXACT || restricted_slew_rate) {
+                recalculate_hdmi_clock(HDMI_EXACT, new_genlock_adjust);
+                last_vlock = HDMI_EXACT;
+                genlock_adjust = new_genlock_adjust;
+                //log_debug("%4d,%4d,%4d,%4d,%4d", genlocked, parameters[F_GENLOCK_LINE], vsync_line, difference, genlock_adjust);
             }
         }
     }
-    if (framecount != 0) {
-      framecount --;
-    }
     if (parameters[F_GENLOCK_MODE] != HDMI_EXACT) {
       // Return 0 if genlock disabled
       return 0;
@@ -1765,6 +1838,15 @@ static void init_hardware() {
    // https://github.com/raspberrypi/firmware/issues/67
    RPI_GetIrqController()->Enable_IRQs_2 = (1 << VSYNCINT);
 
+   // Route it to the FIQ too so arm_fiq_handler timestamps the Pi vsync as it happens
+#if defined(RPI4)
+   RPI_GetIrqController()->Enable_FIQs_2 = (1 << VSYNCINT);
+#else
+   RPI_GetIrqController()->FIQ_control = 0x80 | (32 + VSYNCINT);
+#endif
+   // Unmask the FIQ only, the IRQs stay masked as everything else is polled
+   _set_interrupts(CPSR_IRQ_INHIBIT);
+
    // Configure the GPCLK pin as a GPCLK
    RPI_SetGpioPinFunction(GPCLK_PIN, FS_ALT5);
 
@@ -2020,6 +2102,10 @@ static void cpld_init() {
    log_info("CPLD  Design: %s", cpld->name);
    log_info("CPLD Version: %x.%x", (cpld_version_id >> VERSION_MAJOR_BIT) & 0x0f, (cpld_version_id >> VERSION_MINOR_BIT) & 0x0f);
 
+   if (cpld_fail_state == CPLD_NORMAL) {
+      update_cpld_record_version(cpld_version_id);
+   }
+
    //erase CPLD before anything that might cause a lockup with a corrupt CPLD
 
    if (check_delete_file) {
@@ -2617,7 +2703,7 @@ void DPMS(int dpms_state) {
 }
 
 #ifdef MULTI_BUFFER
-void swapBuffer(int buffer) {
+static void display_buffer(int buffer) {
   current_display_buffer = buffer;
   if (capinfo->bpp == 16) {
      // directly manipulate the display list in 16BPP mode otherwise display list gets reconstructed
@@ -2634,6 +2720,64 @@ void swapBuffer(int buffer) {
   }
 
 }
+
+// Called when a capture completes, the buffer is either displayed immediately or handed to the frame pacer
+void swapBuffer(int buffer) {
+  if (frame_pacing) {
+     if (!pacing_running) {
+        pacing_running = 1;
+        pacing_phase = 0;
+        pacing_completed = 0;
+        pacing_displayed = 0;
+        pacing_vsyncs = 0;
+        pacing_judder = 0;
+        pacing_buffer[0] = buffer;
+        display_buffer(buffer);
+     } else {
+        pacing_buffer[++pacing_completed % NBUFFERS] = buffer;
+     }
+     return;
+  }
+  display_buffer(buffer);
+}
+
+// Called on each Pi vsync. Advances through the completed captures at the source:display rate ratio
+// so each source frame is shown for a fixed cadence (e.g. 1,1,1,1,2 for 50Hz on 60Hz) instead of
+// whenever a capture happens to finish before the vsync. A correction is only made (and counted as
+// judder) if the source drifts far enough from the measured rate to run dry or get too far ahead.
+void frame_pacing_vsync() {
+  if (!pacing_running) {
+     return;
+  }
+  unsigned int target = pacing_displayed;
+  pacing_phase += pacing_src_millihz;
+  while (pacing_phase >= pacing_out_millihz) {
+     pacing_phase -= pacing_out_millihz;
+     target++;
+  }
+  int depth = (int) (pacing_completed - target);
+  if (depth < 0) {
+     target = pacing_completed;
+     pacing_judder++;
+  } else if (depth > FRAME_PACING_MAX_DEPTH) {
+     target = pacing_completed - FRAME_PACING_MAX_DEPTH;
+     pacing_judder++;
+  }
+  if (target != pacing_displayed) {
+     pacing_displayed = target;
+     // below 16bpp this is a mailbox call that doesn't wait for the response, as the staged OSD palette is
+     display_buffer(pacing_buffer[target % NBUFFERS]);
+  }
+  if (++pacing_vsyncs >= pacing_out_millihz / 1000) {
+     pacing_judder_last = pacing_judder;
+     pacing_judder = 0;
+     pacing_vsyncs = 0;
+  }
+}
+
+int get_frame_pacing_judder() {
+  return pacing_judder_last;
+}
 #endif
 
 int get_vsync_width_lines() {
@@ -2710,6 +2854,10 @@ int get_one_line_time_ns() {
     return one_line_time_ns;
 }
 
+int get_vsync_phase_ns() {
+    return vsync_phase_valid ? vsync_phase_ns : -1;
+}
+
 int get_sync_detected() {
     return sync_detected;
 }
@@ -2816,6 +2964,7 @@ void set_resolution(int value, const char *name, int reboot) {
 
 
 void set_scaling(int value, int reboot) {
+   int prescale = 0;
    if (value == SCALING_AUTO) {
         geometry_set_mode(0);
         int width = geometry_get_value(MIN_H_WIDTH);
@@ -2893,10 +3042,23 @@ void set_scaling(int value, int reboot) {
                gscaling = GSCALING_MANUAL;
                filtering = FILTERING_VERY_SOFT;
            break;
+
+           case SCALING_FILL43_SHARP:
+               gscaling = GSCALING_MANUAL43;
+               filtering = FILTERING_SOFT;
+               prescale = get_gprescale_available();   // a saved sharp setting falls back to soft where it isn't offered
+           break;
+
+           case SCALING_FILLALL_SHARP:
+               gscaling = GSCALING_MANUAL;
+               filtering = FILTERING_SOFT;
+               prescale = get_gprescale_available();
+           break;
        }
    }
    parameters[F_SCALING] = value;
    set_gscaling(gscaling);
+   set_gprescale(prescale);
 
    if (reboot != 0 && filtering != old_filtering) {
        reboot_required |= 0x02;
@@ -2951,6 +3113,15 @@ int get_parameter(int parameter) {
     }
 }
 
+// As get_parameter() without the special cases, i.e. the value as set in the menu
+int get_stored_parameter(int parameter) {
+    if (parameter < MAX_PARAMETERS) {
+        return parameters[parameter];
+    } else {
+        return 0;
+    }
+}
+
 void set_parameter(int parameter, int value) {
     switch (parameter) {
         //space for special case handling
@@ -3112,6 +3283,10 @@ int is_genlocked() {
    return genlocked;
 }
 
+int get_beam_race_gap() {
+   return beam_race_gap;
+}
+
 void calculate_fb_adjustment() {
    int double_height = capinfo->sizex2 & SIZEX2_DOUBLE_HEIGHT;
    capinfo->v_adjust  = (capinfo->height >> double_height)  - capinfo->nlines;
@@ -3375,6 +3550,8 @@ void rgb_to_hdmi_main() {
            log_info("ARM: GPIO read = %dns, MBOX read = %dns, Triple MBOX read = %dns (%dns/word)", (int)((double) benchmarkRAM(3) * 1000 / cpuspeed / 100000 + 0.5), (int)((double) benchmarkRAM(4) * 1000 / cpuspeed / 100000 + 0.5), triple, triple / 3);
            log_info("GPU: GPIO read = %dns, MBOX write = %dns", (int)((double) benchmarkRAM(1) * 1000 / cpuspeed / 100000 + 0.5), (int)((double) benchmarkRAM(2) * 1000 / cpuspeed / 100000 + 0.5));
            log_info("RAM: Cached read = %dns, Uncached screen read = %dns", (int)((double) benchmarkRAM(0x2000000) * 1000 / cpuspeed / 100000 + 0.5), (int)((double) benchmarkRAM((int)capinfo->fb) * 1000 / cpuspeed / 100000 + 0.5));
+           benchmarkRAM(6); // first pass to get the LUT cached
+           log_info("12bpp LUT colour correction: +%d cycles per 720 pixel line", benchmarkRAM(6));
 
 
 //***********test CGA artifact decode*********************
@@ -3433,6 +3610,8 @@ void rgb_to_hdmi_main() {
                 }
                 int flags = 0;
                 capinfo->ncapture = ncapture;
+                // No capture loop to pick up a staged palette while polling keys
+                osd_apply_pending_palette();
                 log_info("Entering poll_keys_only, flags=%08x", flags);
                 result = poll_keys_only(capinfo, flags);
                 log_info("Leaving poll_keys_only, result=%04x", result);
@@ -3488,18 +3667,64 @@ void rgb_to_hdmi_main() {
          //paletteFlags |= BIT_MULTI_PALETTE;   // test multi palette
          if (capinfo->mode7) {
             if (capinfo->video_type == VIDEO_TELETEXT) {
-                flags |= parameters[F_MODE7_DEINTERLACE] << OFFSET_INTERLACE;
+                int deinterlace = parameters[F_MODE7_DEINTERLACE];
+                if (deinterlace_setup_mode7(capinfo, deinterlace)) {
+                    // capture without deinterlacing and let core 1 do it after each field
+                    deinterlace = M7DEINTERLACE_NONE;
+                }
+#ifdef USE_ARM_CAPTURE
+                if (_get_hardware_id() == _RPI2 || _get_hardware_id() == _RPI3) {
+                    // the Pi 2/3 ARM capture has no time to deinterlace, the menu only offers modes core 1 can run
+                    deinterlace = M7DEINTERLACE_NONE;
+                }
+#endif
+                flags |= deinterlace << OFFSET_INTERLACE;
             } else {
+                deinterlace_setup(capinfo, 0);
                 flags |= (parameters[F_MODE7_DEINTERLACE] & 1) << OFFSET_INTERLACE;
             }
          } else {
-            flags |= parameters[F_NORMAL_DEINTERLACE] << OFFSET_INTERLACE;
+            int deinterlace = parameters[F_NORMAL_DEINTERLACE];
+            if (deinterlace == DEINTERLACE_MA) {
+                // capture as weave and let core 1 bob the moving areas, or fall back to bob if core 1 can't be used
+                deinterlace = deinterlace_setup(capinfo, 1) ? DEINTERLACE_NONE : DEINTERLACE_BOB;
+            } else {
+                deinterlace_setup(capinfo, 0);
+            }
+            flags |= deinterlace << OFFSET_INTERLACE;
          }
 #ifdef MULTI_BUFFER
-         if ((capinfo->video_type == VIDEO_PROGRESSIVE || (capinfo->video_type == VIDEO_INTERLACED && !interlaced)) && osd_active() && (parameters[F_NUM_BUFFERS] == 0)) {
+         int nbuffers = parameters[F_NUM_BUFFERS];
+         beam_race_nbuffers = -1;
+         if (nbuffers == BEAM_RACE_BUFFERS) {
+            // fall back to double buffering while the beam race gap isn't established, rgb_to_fb follows
+            // beam_race_nbuffers every field so the buffering switches as the gap comes and goes
+            nbuffers = (beam_race_gap < 0) ? 1 : 0;
+            if (!osd_active()) {
+               beam_race_nbuffers = nbuffers;
+            }
+         }
+         // If genlock can't reach the source rate then pace the output using all the buffers
+         // (paused while the OSD is up but the last judder measurement is kept for the info screen)
+         int pacing_wanted = vlock_limited && parameters[F_GENLOCK_MODE] == HDMI_EXACT && capinfo->video_type == VIDEO_PROGRESSIVE
+                        && parameters[F_NUM_BUFFERS] != BEAM_RACE_BUFFERS && get_parameter(F_DROP_FRAME) == 0 && !half_frame_rate;
+         pacing_src_millihz = (int) (source_vsync_freq * 1000);
+         pacing_out_millihz = (int) (info_display_vsync_freq * 1000);
+         if (pacing_src_millihz == 0 || pacing_out_millihz < 1000) {
+            pacing_wanted = 0;
+         }
+         if (!pacing_wanted) {
+            pacing_judder_last = -1;
+         }
+         frame_pacing = pacing_wanted && !osd_active();
+         if (frame_pacing) {
+            nbuffers = NBUFFERS - 1;
+         }
+         pacing_running = 0;
+         if ((capinfo->video_type == VIDEO_PROGRESSIVE || (capinfo->video_type == VIDEO_INTERLACED && !interlaced)) && osd_active() && (nbuffers == 0)) {
             flags |= 2 << OFFSET_NBUFFERS;
          } else {
-            flags |= parameters[F_NUM_BUFFERS] << OFFSET_NBUFFERS;
+            flags |= nbuffers << OFFSET_NBUFFERS;
          }
          //log_info("Buffers = %d", (flags & MASK_NBUFFERS) >> OFFSET_NBUFFERS);
 #endif
@@ -3582,7 +3807,9 @@ void rgb_to_hdmi_main() {
              wait_for_source_fieldsync();
          }
          log_debug("Entering rgb_to_fb, flags=%08x", flags);
+         log_defer(1);
          result = rgb_to_fb(capinfo, flags);
+         log_defer(0);
          log_debug("Leaving rgb_to_fb, result=%04x", result);
          capinfo->palette_control = old_palette_control;
          flags = old_flags;
@@ -3666,8 +3893,6 @@ void rgb_to_hdmi_main() {
          }
 
          if ((clk_changed || (result & RET_INTERLACE_CHANGED)) && !fb_size_changed && !mode_changed) {
-            target_difference = 0;
-            resync_count = 0;
             // Measure the frame time and set the sampling clock
             calibrate_sampling_clock(0);
             // Force recalculation of the HDMI clock (if the genlock_mode property requires this)
@@ -3828,25 +4053,21 @@ void kernel_main(unsigned int r0, unsigned int r1, unsigned int atags)
         int i;
         printf("main running on core %u\r\n", _get_core());
         for (i = 0; i < 10000000; i++);
+        func_ptr worker = _spin_core;
 #ifdef USE_MULTICORE
  #ifdef DONT_USE_MULTICORE_ON_PI2
         if (_get_hardware_id() >= _RPI3 ) {
  #else
         if (_get_hardware_id() >= _RPI2 ) {
  #endif
-            log_info("Starting core 1 at: %08X", _init_core);
-            start_core(1, _init_core);
-        } else {
-            start_core(1, _spin_core);
+            log_info("Starting cores 1-3 at: %08X", _init_core);
+            worker = _init_core;
         }
-#else
-        start_core(1, _spin_core);
 #endif
-        for (i = 0; i < 10000000; i++);
-        start_core(2, _spin_core);
-        for (i = 0; i < 10000000; i++);
-        start_core(3, _spin_core);
-        for (i = 0; i < 10000000; i++);
+        for (int core = 1; core < 4; core++) {
+            start_core(core, worker);
+            for (i = 0; i < 10000000; i++);
+        }
     }
 
     rgb_to_hdmi_main();
@@ -22,6 +22,7 @@ void set_timingset(int value);
 int  get_adjusted_ntscphase();
 int  get_lines_per_vsync(int compensate);
 int  get_one_line_time_ns();
+int  get_vsync_phase_ns();
 int  get_vsync_width_lines();
 int  get_sync_detected();
 int  get_50hz_state();
@@ -29,6 +30,7 @@ int  get_core_1_available();
 
 void set_parameter(int parameter, int value);
 int get_parameter(int parameter);
+int get_stored_parameter(int parameter);
 
 int show_detected_status(int line);
 void delay_in_arm_cycles_cpu_adjust(int cycles);
@@ -42,6 +44,9 @@ void calculate_cpu_timings();
 int read_cpld_version();
 // Status
 int is_genlocked();
+int get_beam_race_gap();
+int get_frame_pacing_judder();
+void frame_pacing_vsync();
 void set_status_message(char *msg);
 void force_reinit();
 void set_helper_flag();
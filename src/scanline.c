@@ -0,0 +1,65 @@
+#include <stdint.h>
+#include <math.h>
+#include "defs.h"
+#include "osd.h"
+#include "scanline.h"
+
+// Scanline and CRT mask tables
+//
+// Everything here is worked out when the palette is rebuilt so the capture kernels are unchanged: the
+// scanline curve maps each 8 bit channel value of a dimmed line to its darkened value and is applied to
+// the scanline half of the palette, the mask tables are copies of the 12bpp colour correction LUT for each
+// column of an aperture grille triad and are applied by core 1 when it renders lines from the line FIFO.
+// The 16bpp kernels dim scanlines themselves (capinfo->intensity) so there the style only shapes the mask.
+
+uint8_t scanline_curve[256];
+unsigned short scanline_mask_4096[3][4096] __attribute__((aligned(32)));
+int scanline_mask_enabled;
+
+static int scanline_dim(int style, int level, int v) {
+   int out;
+   switch (style) {
+   case SCANLINE_WEIGHTED:
+      // bright pixels bloom into the gap between lines so they are dimmed less than dark ones
+      out = v * (level * 255 * 255 + (15 - level) * v * v) / (15 * 255 * 255);
+      break;
+   case SCANLINE_LINEAR_LIGHT:
+      // dim in linear light rather than in gamma corrected values
+      out = (int) (255.0 * pow(pow(v / 255.0, 2.2) * level / 15.0, 1 / 2.2) + 0.5);
+      break;
+   default:
+      out = v * level / 15;
+      break;
+   }
+   return out > 255 ? 255 : out;
+}
+
+void scanline_build_curve(int style, int level) {
+   for (int v = 0; v < 256; v++) {
+      scanline_curve[v] = scanline_dim(style, level, v);
+   }
+}
+
+// The channels not lit in each column are dimmed to the scanline level in the scanline style. This takes its
+// own level rather than using scanline_curve as the mask is applied to single height lines where the curve is flat.
+void scanline_build_mask(unsigned short *palette, int mask, int style, int level) {
+   scanline_mask_enabled = (mask == CRTMASK_APERTURE);
+   if (!scanline_mask_enabled) {
+      return;
+   }
+   for (int i = 0; i < 4096; i++) {
+      int colour = palette[i];
+      for (int column = 0; column < 3; column++) {
+         int out = colour & 0xf000;
+         for (int channel = 0; channel < 3; channel++) {
+            int shift = 8 - channel * 4;        // red, green, blue
+            int value = (colour >> shift) & 0x0f;
+            if (channel != column) {
+               value = scanline_dim(style, level, value * 0x11) >> 4;
+            }
+            out |= value << shift;
+         }
+         scanline_mask_4096[column][i] = out;
+      }
+   }
+}
@@ -0,0 +1,15 @@
+// scanline.h
+
+#ifndef SCANLINE_H
+#define SCANLINE_H
+
+#include <stdint.h>
+
+extern uint8_t scanline_curve[256];
+extern unsigned short scanline_mask_4096[3][4096];
+extern int scanline_mask_enabled;
+
+void scanline_build_curve(int style, int level);
+void scanline_build_mask(unsigned short *palette, int mask, int style, int level);
+
+#endif
@@ -11,6 +11,8 @@ extern void _enable_interrupts( void );
 
 extern void _set_interrupts( int cpsr );
 
+#define CPSR_IRQ_INHIBIT 0x80
+
 extern int _disable_interrupts( void );
 
 extern unsigned int _get_cpsr();
@@ -39,7 +41,7 @@ extern void _invalidate_dtlb();
 
 extern void _invalidate_dtlb_mva(void *address);
 
-extern void __data_memory_barrier();
+extern void _data_memory_barrier();
 
 extern unsigned int _get_core();
 
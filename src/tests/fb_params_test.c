@@ -0,0 +1,242 @@
+// fb_params_test.c
+//
+// Host test for the geometry_get_fb_params() memo: for every profile under scripts/Profiles it checks that the
+// result returned on a memo hit is identical to a fresh geometry_calculate_fb_params() for a spread of display
+// sizes, scaling modes and capture sample widths, and that calculate_cpu_timings() still runs on every call.
+//
+// Build and run from src/tests:
+//
+//    gcc -O1 -Wall -o /tmp/fb_params_test fb_params_test.c && /tmp/fb_params_test ../scripts/Profiles
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <dirent.h>
+#include <sys/stat.h>
+#include "../defs.h"
+
+// the display size is read back from the pixel valve so point it at a host variable instead
+static uint32_t pv_horzb;
+static uint32_t pv_vertb;
+#undef PIXELVALVE2_HORZB
+#undef PIXELVALVE2_VERTB
+#define PIXELVALVE2_HORZB (&pv_horzb)
+#define PIXELVALVE2_VERTB (&pv_vertb)
+
+#include "../geometry.c"
+
+// ----------------------------------------------------------------------
+// Stubs for the rest of the firmware
+// ----------------------------------------------------------------------
+
+static int features[256];
+static int config_overscan[4];
+static int startup_overscan_calls;
+static int cpu_timings_calls;
+
+unsigned int _get_hardware_id()     { return _RPI3; }
+unsigned int _get_peripheral_base() { return 0; }
+void delay_in_arm_cycles_cpu_adjust(int cycles) { }
+void reboot() { fprintf(stderr, "reboot() called\n"); exit(1); }
+void log_info(const char *fmt, ...) { }
+
+int get_parameter(int parameter) { return features[parameter]; }
+int get_adjusted_ntscphase() { return 0; }
+int get_lines_per_vsync(int compensate) { return 312; }
+int get_vsync_width_lines() { return 3; }
+int get_core_1_available() { return 1; }
+int lumacode_multiplier() { return 1; }
+int osd_active() { return 0; }
+int menu_active() { return 0; }
+void calculate_cpu_timings() { cpu_timings_calls++; }
+
+int get_startup_overscan() {
+   startup_overscan_calls++;
+   return 0;
+}
+
+void set_config_overscan(int l, int r, int t, int b) {
+   config_overscan[0] = l;
+   config_overscan[1] = r;
+   config_overscan[2] = t;
+   config_overscan[3] = b;
+}
+
+void get_config_overscan(int *l, int *r, int *t, int *b) {
+   *l = config_overscan[0];
+   *r = config_overscan[1];
+   *t = config_overscan[2];
+   *b = config_overscan[3];
+}
+
+static int get_delay()     { return 0; }
+static int get_sync_edge() { return 0; }
+static cpld_t test_cpld = { .get_delay = get_delay, .get_sync_edge = get_sync_edge };
+cpld_t *cpld = &test_cpld;
+
+// ----------------------------------------------------------------------
+// Profile parsing (a cut down version of what osd.c does)
+// ----------------------------------------------------------------------
+
+static const struct {
+   int key;
+   const char *property_name;
+} fb_features[] = {
+   { F_AUTO_SWITCH,       "auto_switch"      },
+   { F_HDMI_MODE_STANDBY, "hdmi_standby"     },
+   { F_PALETTE_CONTROL,   "palette_control"  },
+   { F_NTSC_COLOUR,       "ntsc_colour"      },
+   { F_NTSC_TYPE,         "ntsc_type"        },
+   { F_MODE7_SCALING,     "teletext_scaling" },
+   { F_NORMAL_SCALING,    "normal_scaling"   },
+   { F_FFOSD,             "ffosd_overlay"    },
+   { F_SWAP_ASPECT,       "swap_aspect"      },
+   { F_OUTPUT_INVERT,     "output_invert"    },
+   { F_SCANLINES,         "scanlines"        },
+   { F_CROP_BORDER,       "crop_border"      },
+   { F_SCREENCAP_SIZE,    "screencap_size"   },
+   { F_BORDER_COLOUR,     "border_colour"    },
+   { F_INTEGER_ASPECT,    "integer_aspect"   },
+   { -1,                  NULL               }
+};
+
+static int apply_profile(const char *path) {
+   char line[1024];
+   FILE *fp = fopen(path, "r");
+   if (!fp) {
+      return 0;
+   }
+   while (fgets(line, sizeof(line), fp)) {
+      line[strcspn(line, "\r\n")] = 0;
+      char *value = strchr(line, '=');
+      if (!value) {
+         continue;
+      }
+      *value++ = 0;
+      if (strcmp(line, "geometry") == 0) {
+         char *tok = strtok(value, ",");
+         for (int i = 1; tok && params[i].key >= 0; i++) {
+            geometry_set_value(params[i].key, atoi(tok));
+            tok = strtok(NULL, ",");
+         }
+      } else {
+         for (int i = 0; fb_features[i].key >= 0; i++) {
+            if (strcmp(line, fb_features[i].property_name) == 0) {
+               features[fb_features[i].key] = atoi(value);
+            }
+         }
+      }
+   }
+   fclose(fp);
+   return 1;
+}
+
+// ----------------------------------------------------------------------
+// Test
+// ----------------------------------------------------------------------
+
+typedef struct {
+   capture_info_t capinfo;
+   int scale[4];
+   int overscan[4];
+} fb_result_t;
+
+static const int displays[][2] = { { 1920, 1080 }, { 1280, 1024 }, { 720, 576 }, { 640, 480 } };
+static const int sample_widths[] = { SAMPLE_WIDTH_3, SAMPLE_WIDTH_6, SAMPLE_WIDTH_12 };
+
+static int num_profiles;
+static int num_checks;
+static int num_hits;
+static int num_failures;
+
+static void get_result(int sample_width, fb_result_t *result) {
+   memset(result, 0, sizeof(*result));
+   result->capinfo.sample_width = sample_width;
+   geometry_get_fb_params(&result->capinfo);
+   result->scale[0] = caphscale;
+   result->scale[1] = capvscale;
+   result->scale[2] = fhaspect;
+   result->scale[3] = fvaspect;
+   get_config_overscan(&result->overscan[0], &result->overscan[1], &result->overscan[2], &result->overscan[3]);
+}
+
+static void test_profile(const char *dir, const char *name) {
+   char path[1024];
+   fb_result_t first, cached, fresh;
+
+   memset(features, 0, sizeof(features));
+   memset(&set1_geometry, 0, sizeof(set1_geometry));
+   geometry_set_mode(0);
+   snprintf(path, sizeof(path), "%s/Default.txt", dir);
+   apply_profile(path);
+   snprintf(path, sizeof(path), "%s/%s", dir, name);
+   if (!apply_profile(path)) {
+      return;
+   }
+   num_profiles++;
+
+   for (int d = 0; d < sizeof(displays) / sizeof(displays[0]); d++) {
+      pv_horzb = displays[d][0];
+      pv_vertb = displays[d][1];
+      for (int s = 0; s <= GSCALING_MANUAL; s++) {
+         for (int p = 0; p <= 1; p++) {
+            for (int w = 0; w < sizeof(sample_widths) / sizeof(sample_widths[0]); w++) {
+               set_gscaling(s);
+               set_gprescale(p);
+               set_config_overscan(0, 0, 0, 0);
+               int calls = cpu_timings_calls;
+               // the first call leaves the config overscan as it will be on the next one, so the second can hit
+               get_result(sample_widths[w], &first);
+               int misses = startup_overscan_calls;
+               get_result(sample_widths[w], &cached);
+               if (startup_overscan_calls - misses == 1) {
+                  num_hits++;
+               }
+               fb_params_valid = 0;
+               get_result(sample_widths[w], &fresh);
+               num_checks++;
+               if (memcmp(&first, &fresh, sizeof(fresh)) != 0 || memcmp(&cached, &fresh, sizeof(fresh)) != 0) {
+                  printf("FAIL: %s (%dx%d scaling=%d prescale=%d sample_width=%d)\n", path, displays[d][0], displays[d][1], s, p, sample_widths[w]);
+                  num_failures++;
+               }
+               if (cpu_timings_calls - calls != 3) {
+                  printf("FAIL: %s calculate_cpu_timings() not called on every geometry_get_fb_params()\n", path);
+                  num_failures++;
+               }
+            }
+         }
+      }
+   }
+}
+
+static void test_dir(const char *dir) {
+   DIR *dp = opendir(dir);
+   struct dirent *entry;
+   char path[1024];
+   struct stat st;
+   if (!dp) {
+      return;
+   }
+   while ((entry = readdir(dp)) != NULL) {
+      if (entry->d_name[0] == '.') {
+         continue;
+      }
+      snprintf(path, sizeof(path), "%s/%s", dir, entry->d_name);
+      if (stat(path, &st) != 0) {
+         continue;
+      }
+      if (S_ISDIR(st.st_mode)) {
+         test_dir(path);
+      } else if (strstr(entry->d_name, ".txt") && strcmp(entry->d_name, "Default.txt") != 0) {
+         test_profile(dir, entry->d_name);
+      }
+   }
+   closedir(dp);
+}
+
+int main(int argc, char **argv) {
+   test_dir(argc > 1 ? argv[1] : "../scripts/Profiles");
+   printf("%d profiles, %d checks, %d memo hits, %d failures\n", num_profiles, num_checks, num_hits, num_failures);
+   return (num_profiles == 0 || num_hits == 0 || num_failures != 0);
+}
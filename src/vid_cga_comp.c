@@ -212,8 +212,11 @@ static Bit8u byte_clamp(int v) {
 #define SCALER_MAXWIDTH 2048
 
 static int temp[SCALER_MAXWIDTH + 10]={0};
-static int atemp[SCALER_MAXWIDTH + 2]={0};
-static int btemp[SCALER_MAXWIDTH + 2]={0};
+
+/* Chroma and luma extracted directly from the composite samples around p */
+#define CHROMA_A(p) ((p)[-4]-(((p)[-2]-(p)[0]+(p)[2])<<1)+(p)[4])
+#define CHROMA_B(p) (((p)[-3]-(p)[-1]+(p)[1]-(p)[3])<<1)
+#define LUMA(p) (((p)[0]<<3) - CHROMA_A(p))
 
 void Composite_Process(Bit32u blocks, Bit8u *rgbi, int render)
 {
@@ -222,7 +225,8 @@ void Composite_Process(Bit32u blocks, Bit8u *rgbi, int render)
     int w = blocks*8;
     int *o;
     int *i;
-    int *ap, *bp;
+    int y0, y1, y2;
+    int ca1, ca2;
 
     uint32_t temp_srgb;
     uint32_t srgb0;
@@ -231,18 +235,20 @@ void Composite_Process(Bit32u blocks, Bit8u *rgbi, int render)
     uint32_t srgb3;
 
 #define COMPOSITE_CONVERT(I, Q) do { \
-        i[1] = (i[1]<<3) - ap[1]; \
-        a = ap[0]; \
-        b = bp[0]; \
-        c = i[0]+i[0]; \
-        d = i[-1]+i[1]; \
+        ca2 = CHROMA_A(i + 1); \
+        y2 = (i[1]<<3) - ca2; \
+        a = ca1; \
+        b = CHROMA_B(i); \
+        c = y1+y1; \
+        d = y0+y2; \
         y = ((c+d)<<8) + video_sharpness*(c-d); \
         rr = y + video_ri*(I) + video_rq*(Q); \
         gg = y + video_gi*(I) + video_gq*(Q); \
         bb = y + video_bi*(I) + video_bq*(Q); \
+        y0 = y1; \
+        y1 = y2; \
+        ca1 = ca2; \
         ++i; \
-        ++ap; \
-        ++bp; \
 } while (0)
 
 #define OUT(v) do { *o = (v); ++o; } while (0)
@@ -255,23 +261,12 @@ void Composite_Process(Bit32u blocks, Bit8u *rgbi, int render)
                 ++rgbi;
         }
 
-        /* Store chroma */
-        i = temp + 4;
-        ap = atemp + 1;
-        bp = btemp + 1;
-        for (x = -1; x < w + 1; ++x) {
-                ap[x] = i[-4]-((i[-2]-i[0]+i[2])<<1)+i[4];
-                bp[x] = (i[-3]-i[-1]+i[1]-i[3])<<1;
-
-                //   ap[x] = (-i[-2]+((i[0])<<1)-i[2])<<1;
-                //   bp[x] = (-i[-1]+i[1])<<2;
-                ++i;
-        }
-
-        /* Decode */
+        /* Decode in a single pass, extracting chroma and luma from the composite samples as they are used.
+           The chroma of the sample ahead is carried over in ca1 so each one is only worked out once. */
         i = temp + 5;
-        i[-1] = (i[-1]<<3) - ap[-1];
-        i[0] = (i[0]<<3) - ap[0];
+        ca1 = CHROMA_A(i);
+        y0 = LUMA(i - 1);
+        y1 = (i[0]<<3) - ca1;
         for (x2 = 0; x2 < blocks - 1; ++x2) {
             int y,a,b,c,d,rr,gg,bb;
                 COMPOSITE_CONVERT(a, b);
@@ -297,6 +292,9 @@ void Composite_Process(Bit32u blocks, Bit8u *rgbi, int render)
 
 #undef COMPOSITE_CONVERT
 #undef OUT
+#undef LUMA
+#undef CHROMA_B
+#undef CHROMA_A
 }
 
 void Test_Composite_Process(Bit32u blocks, Bit8u *rgbi, int render) {